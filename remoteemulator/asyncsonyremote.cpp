@@ -1,219 +1,344 @@
 #include "sonyremote.h"
+#include "spscqueue.h"
+#include "binlog.h"
 
-namespace asr{
-  volatile bool hasData = false;
-  volatile bool isReadyForText = true;
-  volatile bool isInitialized = true;
-
-  volatile bool awaitingNextMessage = true;
-  volatile unsigned long long int bitStartTime;
-
-  volatile uint8_t messageBuffer[11];
-  volatile uint8_t messageBufferOffset;
-
-  volatile uint8_t outboundBuffer[11];
-  volatile bool hasMessageToSend;
-
-  volatile uint8_t completeMessageBuffer[11 * 10];
-  volatile uint8_t completeMessageOffset = 0;
+BusDecoder::BusDecoder() : bitClassifier(DATABIT_LOW_RANGE, DATABIT_THRESHOLD_RANGE){
+  memset((void*) messageBuffer, 0, sizeof(messageBuffer));
+}
 
-  volatile enum class TransmitState{
-    AWAITING_MESSAGE, BEFORE_SYNC, IN_PLAYER_HEADER, IN_REMOTE_HEADER, PLAYER_SENDING, REMOTE_SENDING
-  } state;
+inline void BusDecoder::recordPulse(TransmitState in, ul duration){
+  PulseStatistics &stats = busTelemetry.pulses[static_cast<uint8_t>(in)];
+  if(!stats.count || duration < stats.min) stats.min = duration;
+  if(duration > stats.max) stats.max = duration;
+  stats.total += duration;
+  ++stats.count;
+}
 
-  volatile uint8_t playerHeaderFlags;
+inline void BusDecoder::resetComm(ResetReason why){
+  #ifdef REMOTE_DEBUG
+  binlog::log(LogId::BUS_RESET, static_cast<uint8_t>(why));
+  #endif
+  ++busTelemetry.resets[static_cast<uint8_t>(why)];
+  playerHeaderFlags = 0;
+  state = TransmitState::AWAITING_MESSAGE;
+  messageBufferOffset = 0;
+}
 
-  volatile uint8_t writePin;
-  volatile uint8_t readPin;
+inline void BusDecoder::writeDataBit(bool s){
+  #ifdef ASYNC_DEFERRED_DECODING
+  // Decoding happens long after the edge - too late to answer on the bus.
+  (void) s;
+  #else
+  if(!s || !pulseTimer || passive) return;
+  // The timer releases the pin - nothing here waits for the bit to end.
+  pulseTimer->pulse(DATA_DURATION);
+  #endif
+}
 
-  inline bool inRange(ul mn, ul mx, ul v){ 
-    return v > mn && v < mx; 
+void BusDecoder::queueMessage(BusDirection direction){
+  #ifdef REMOTE_DEBUG
+  uint8_t csum = 0;
+  for(uint8_t i = 0; i<11; i++) csum ^= messageBuffer[i];
+  if(csum){
+    uint32_t start = messageBuffer[0] | (messageBuffer[1] << 8) | (messageBuffer[2] << 16) | ((uint32_t) messageBuffer[3] << 24);
+    binlog::log(LogId::CHECKSUM_ERROR, csum, start);
   }
+  #endif
+  Message message;
+  for(uint8_t i = 0; i<11; i++) {
+    message.data[i] = messageBuffer[i];
+    messageBuffer[i] = 0;
+  }
+  message.direction = direction;
+  message.header = remoteHeaderFlags;
+  message.time = messageStart;
+  if(messageQueue.push(message)) {
+    uint16_t queued = messageQueue.size();
+    if(queued > queueHighWaterMark) queueHighWaterMark = queued;
+  }else{
+    ++droppedMessages;
+    binlog::log(LogId::QUEUE_OVERFLOW, droppedMessages);
+  }
+}
 
+bool BusDecoder::queueOutbound(const uint8_t *frame, OutboundPriority priority, ul maxAge, ul now){
+  OutboundMessage message;
+  memcpy(message.data, frame, sizeof(message.data));
+  message.queued = now;
+  message.maxAge = maxAge;
+  return outbound[static_cast<uint8_t>(priority)].push(message);
+}
 
-  inline bool toBit(unsigned long int time){
-    return !inRange(DATABIT_LOW_RANGE, time);
-  }
+bool BusDecoder::hasOutbound(){
+  for(uint8_t i = 0; i<OUTBOUND_PRIORITIES; i++) if(!outbound[i].isEmpty()) return true;
+  return false;
+}
 
-  inline void resetComm(const char *why){
-    D("RC ");
-    D(why);
-    DN;
-    playerHeaderFlags = 0;
-    state = TransmitState::AWAITING_MESSAGE;
-    messageBufferOffset = 0;
-  }
+uint8_t BusDecoder::getOutboundLength(){
+  uint8_t length = 0;
+  for(uint8_t i = 0; i<OUTBOUND_PRIORITIES; i++) length += outbound[i].size();
+  return length;
+}
 
-  inline void writeDataBit(bool s){
-    if(!s) return;
-    digitalWrite(writePin, HIGH);
-    delayMicroseconds(DATA_DURATION);
-    digitalWrite(writePin, LOW);
+// Remote header, bit 4: picks what goes out if the player cedes the bus in this frame.
+// Until it has started, a message can still be overtaken or expire.
+inline bool BusDecoder::announceOutbound(ul now){
+  sending = NULL;
+  for(int8_t i = OUTBOUND_PRIORITIES - 1; i >= 0 && !sending; i--){
+    const OutboundMessage *message;
+    while((message = outbound[i].front())){
+      if(!message->maxAge || now - message->queued <= message->maxAge){
+        sending = message;
+        sendingPriority = i;
+        break;
+      }
+      outbound[i].drop();
+      ++busTelemetry.outboundExpired;
+    }
   }
+  return sending;
+}
 
-  void asyncSonyRemoteISR(){
-    if(digitalRead(3) == LOW){
-      // falling
-      bitStartTime = micros();
-      return;
-    }
-    // Rising - End of bit
-    
-    unsigned long long int duration = micros() - bitStartTime;
-    switch(state){
-      case TransmitState::AWAITING_MESSAGE:
-        if(inRange(PRESYNC_RANGE, duration)) {
-          state = TransmitState::BEFORE_SYNC;
-        } else {
-          resetComm("PRESYNC");
-        }
+void BusDecoder::decodeEdge(bool level, ul time){
+  if(level == LOW){
+    // falling
+    bitStartTime = time;
+    return;
+  }
+  // Rising - End of bit
+  
+  ul duration = time - bitStartTime;
+  recordPulse(state, duration);
+  switch(state){
+    case TransmitState::AWAITING_MESSAGE:
+      if(inRange(PRESYNC_RANGE, duration) || inRange(PRESYNC_RESET_RANGE, duration)) {
+        // A long presync resets the bus - this frame's header says we're not initialized yet
+        playerReset = inRange(PRESYNC_RESET_RANGE, duration);
+        if(playerReset) sending = NULL; // Nothing is announced - it goes out again after the reset
+        messageStart = bitStartTime;
+        state = TransmitState::BEFORE_SYNC;
+      } else {
+        resetComm(ResetReason::PRESYNC);
+      }
+      break;
+    case TransmitState::BEFORE_SYNC:
+      if(inRange(SYNC_RANGE, duration)) {
+        state = TransmitState::IN_REMOTE_HEADER;
+        messageBufferOffset = 0;
+        remoteHeaderFlags = 0;
+        // fall through
+      }
+      else{ 
+        resetComm(ResetReason::SYNC);
         break;
-      case TransmitState::BEFORE_SYNC:
-        if(inRange(SYNC_RANGE, duration)) {
-          state = TransmitState::IN_REMOTE_HEADER;
+      }
+    case TransmitState::IN_REMOTE_HEADER:
+      // Offset 0 is the end of SYNC. Our own bits are decoded too - they feed the classifier.
+      if(messageBufferOffset) remoteHeaderFlags |= bitClassifier.toBit(duration) << (messageBufferOffset - 1);
+      switch(messageBufferOffset++){
+        case 0:
+        case 2:
+        case 3:
+        case 5:
+        case 6:
+          writeDataBit(0);
+          break;
+        case 1:
+          writeDataBit(isReadyForText && !playerReset);
+          break;
+        case 4:
+          writeDataBit(!passive && !playerReset && announceOutbound(time));
+          break;
+        case 7:
+          writeDataBit(isInitialized && !playerReset);
+          break;
+        case 8:
           messageBufferOffset = 0;
-          // fall through
-        }
-        else{ 
-          resetComm("SYNC");
+          playerHeaderFlags = 0;
+          state = TransmitState::IN_PLAYER_HEADER;
+        default:
+          break;
+      }
+      break;
+    case TransmitState::IN_PLAYER_HEADER:
+      playerHeaderFlags |= (bitClassifier.toBit(duration) << messageBufferOffset++);
+      if(messageBufferOffset == 8) {
+        messageBufferOffset = 0;
+        bool hasData = !(playerHeaderFlags & 0x1);
+        bool cedeBus = playerHeaderFlags & (1 << 4);
+        messageBufferOffset = 0;
+        if(hasData && !cedeBus){
+          state = TransmitState::PLAYER_SENDING;
+          break;
+        }else if(cedeBus && (passive ? remoteHeaderFlags & 0x10 : sending != NULL)){
+          state = TransmitState::REMOTE_SENDING;
           break;
         }
-      case TransmitState::IN_REMOTE_HEADER:
-        switch(messageBufferOffset++){
-          case 0:
-          case 2:
-          case 3:
-          case 5:
-          case 6:
-            writeDataBit(0);
-            break;
-          case 1:
-            writeDataBit(isReadyForText);
-            break;
-          case 4:
-            writeDataBit(hasMessageToSend);
-            break;
-          case 7:
-            writeDataBit(isInitialized);
-            break;
-          case 8:
-            messageBufferOffset = 0;
-            playerHeaderFlags = 0;
-            state = TransmitState::IN_PLAYER_HEADER;
-          default:
-            break;
+        state = TransmitState::AWAITING_MESSAGE;
+      }
+      break;
+    case TransmitState::REMOTE_SENDING:
+      if(passive){
+        // The remote writes at a rising edge, so the first low is a lead-in and bit n ends at offset n + 1
+        if(messageBufferOffset){
+          uint8_t bit = messageBufferOffset - 1;
+          messageBuffer[bit >> 3] |= (bitClassifier.toBit(duration) << (bit & 0b111));
         }
-        break;
-      case TransmitState::IN_PLAYER_HEADER:
-        playerHeaderFlags |= (toBit(duration) << messageBufferOffset++);
-        if(messageBufferOffset == 8) {
-          messageBufferOffset = 0;
-          bool hasData = !(playerHeaderFlags & 0x1);
-          bool cedeBus = playerHeaderFlags & (1 << 4);
-          messageBufferOffset = 0;
-          if(hasData && !cedeBus){
-            state = TransmitState::PLAYER_SENDING;
-            break;
-          }else if(cedeBus && hasMessageToSend){
-            state = TransmitState::REMOTE_SENDING;
-            break;
-          }
-          state = TransmitState::AWAITING_MESSAGE;
-        }
-        break;
-      case TransmitState::REMOTE_SENDING:
-        if(messageBufferOffset < 88){
-          writeDataBit(outboundBuffer[messageBufferOffset >> 3] & (1 << (messageBufferOffset & 0b111)));
-          ++messageBufferOffset;
-        }else{
-          hasMessageToSend = false;
-          memset((void*) outboundBuffer, 0, 11);
-          resetComm("RS");
+        if(++messageBufferOffset > 88){
+          queueMessage(BusDirection::REMOTE);
+          resetComm(ResetReason::REMOTE_SENT);
         }
         break;
-      case TransmitState::PLAYER_SENDING:
-        messageBuffer[messageBufferOffset >> 3] |= (toBit(duration) << (messageBufferOffset & 0b111));
+      }
+      if(messageBufferOffset < 88){
+        writeDataBit(sending->data[messageBufferOffset >> 3] & (1 << (messageBufferOffset & 0b111)));
         ++messageBufferOffset;
-        if(messageBufferOffset >= 88){
-          #ifdef REMOTE_DEBUG
-          uint8_t csum = 0;
-          for(uint8_t i = 0; i<11; i++) csum ^= messageBuffer[i];
-          if(csum){
-            D("----------CSUM ERR----------\n");
-            D(csum);
-            DN;
-            for(uint8_t i = 0; i<11; i++){
-              D(messageBuffer[i], HEX);
-              D(" ");
-            }
-            D("\n----------------------------\n");
-          }
-          #endif
-          if(completeMessageOffset < 10) {
-            uint8_t bufferOffset = 11 * completeMessageOffset++;
-            for(uint8_t i = 0; i<11; i++) {
-              completeMessageBuffer[bufferOffset + i] = messageBuffer[i];
-              messageBuffer[i] = 0;
-            }
-          }else
-            D("Error - queue overflow!\n");
-          resetComm("OK");
-        }
-        break;
-    }
+      }else{
+        // Only now the slot is free - a message cut off by a bus reset is sent again
+        outbound[sendingPriority].drop();
+        sending = NULL;
+        ++busTelemetry.outboundSent;
+        resetComm(ResetReason::REMOTE_SENT);
+      }
+      break;
+    case TransmitState::PLAYER_SENDING:
+      messageBuffer[messageBufferOffset >> 3] |= (bitClassifier.toBit(duration) << (messageBufferOffset & 0b111));
+      ++messageBufferOffset;
+      if(messageBufferOffset >= 88){
+        queueMessage(BusDirection::PLAYER);
+        resetComm(ResetReason::MESSAGE_RECEIVED);
+      }
+      break;
   }
-  uint8_t readingCursor = 0;
-  uint8_t writingCursor = 0;
+  telemetryVersion = telemetryVersion + 1;
+}
+
+void BusDecoder::timeout(){
+  // Only queueMessage() clears the buffer - the bits of a cut off frame would end up in the next one
+  for(uint8_t i = 0; i<11; i++) messageBuffer[i] = 0;
+  resetComm(ResetReason::TIMEOUT);
+  telemetryVersion = telemetryVersion + 1;
 }
 
-using namespace asr;
+void BusDecoder::handleEdge(bool level){
+  Edge edge = { timebase::now(), level };
+  #ifndef ASYNC_DEFERRED_DECODING
+  if(!rawCapture){
+    decodeEdge(level, edge.time);
+    return;
+  }
+  #endif
+  // Only timestamp the edge - handleMessage() or the edge streamer picks it up.
+  if(!edgeQueue.push(edge)) droppedEdges = droppedEdges + 1;
+}
 
-AsyncSonyRemote::AsyncSonyRemote(int r, int w){
-  writePin = w;
-  readPin = r;
+AsyncSonyRemoteBase::AsyncSonyRemoteBase(PulseTimer *t){
+  bus.pulseTimer = t;
 }
 
-void AsyncSonyRemote::begin(){
-  attachInterrupt(digitalPinToInterrupt(readPin), asyncSonyRemoteISR, CHANGE);
+void AsyncSonyRemoteBase::begin(uint8_t readPin, void (*isr)()){
+  timebase::begin();
+  if(!bus.passive){
+    bus.pulseTimer->begin();
+    pulseTimerStarted = true;
+  }
+  attachInterrupt(digitalPinToInterrupt(readPin), isr, CHANGE);
 }
 
-bool AsyncSonyRemote::readDataBit(){
-  bool b = completeMessageBuffer[readingCursor >> 3] & (1 << (readingCursor & 0b111));
-  ++readingCursor;
-  return b;
+void AsyncSonyRemoteBase::setPassive(bool passive){
+  bus.passive = passive;
+  if(!passive && !pulseTimerStarted && bus.pulseTimer){
+    bus.pulseTimer->begin();
+    pulseTimerStarted = true;
+  }
 }
 
-void AsyncSonyRemote::addBitToSend(bool b){
-  outboundBuffer[writingCursor >> 3] |= b << (writingCursor & 0b111);
+void AsyncSonyRemoteBase::addBitToSend(bool b){
+  if(writingCursor >= 88) return;
+  outboundFrame[writingCursor >> 3] |= b << (writingCursor & 0b111);
   ++writingCursor;
 }
 
-void AsyncSonyRemote::finaliseOutboundMessage(){
-  hasMessageToSend = true;
+void AsyncSonyRemoteBase::finaliseOutboundMessage(OutboundPriority priority){
+  if(!bus.passive) sendMessage(outboundFrame, priority, priority == OutboundPriority::RESPONSE ? RESPONSE_MAX_AGE : 0);
+  discardOutboundMessage();
 }
 
-bool AsyncSonyRemote::handleMessage(){
-  if(completeMessageOffset){
-    readingCursor = 0;
-    #ifdef REMOTE_DEBUG
-    D("Handling: \n");
-    for(int i = 0; i<11; i++){
-      D(completeMessageBuffer[i], HEX);
-      D(" ");
-    }
-    DN;
-    #endif
+void AsyncSonyRemoteBase::discardOutboundMessage(){
+  memset(outboundFrame, 0, sizeof(outboundFrame));
+  writingCursor = 0;
+}
 
-    handlePlayerMessage();
+bool AsyncSonyRemoteBase::sendMessage(const uint8_t *frame, OutboundPriority priority, ul maxAge){
+  if(bus.passive) return false; // Nothing is ever sent
+  if(!bus.queueOutbound(frame, priority, maxAge, timebase::now())){
+    ++telemetry.outboundRejected;
+    return false;
+  }
+  ++telemetry.outboundQueued;
+  return true;
+}
 
-    noInterrupts();
-    for(uint8_t i = 11; i<110; i++){
-      completeMessageBuffer[i - 11] = completeMessageBuffer[i];
-    }    
-    --completeMessageOffset;
-    interrupts();
+void AsyncSonyRemoteBase::decodePendingEdges(){
+  if(bus.rawCapture) return; // The queue belongs to readRawEdge()
+  BusDecoder::Edge edge;
+  while(bus.edgeQueue.pop(edge)){
+    bus.decodeEdge(edge.level, edge.time);
+  }
+}
 
-    return true;
+bool AsyncSonyRemoteBase::handleMessage(){
+  decodePendingEdges();
+  bus.bitClassifier.recalibrate();
+  BusDecoder::Message *currentMessage = bus.messageQueue.front();
+  if(!currentMessage) return false;
+
+  #ifdef REMOTE_DEBUG
+  D("Handling: \n");
+  for(int i = 0; i<11; i++){
+    D(currentMessage->data[i], HEX);
+    D(" ");
   }
-  return false;
+  DN;
+  #endif
+
+  if(currentMessage->direction == BusDirection::REMOTE){
+    handleRemoteMessage(currentMessage->data, currentMessage->header, currentMessage->time);
+  }else{
+    handlePlayerMessage(currentMessage->data, currentMessage->time);
+  }
+
+  // The slot belongs to the ISR again only after it has been parsed.
+  bus.messageQueue.drop();
+  return true;
+}
+
+void AsyncSonyRemoteBase::setRawCapture(bool enabled){
+  bus.rawCapture = enabled;
+  bus.edgeQueue.clear();
+}
+
+bool AsyncSonyRemoteBase::readRawEdge(BusDecoder::Edge &edge){
+  return bus.edgeQueue.pop(edge);
+}
+
+uint16_t AsyncSonyRemoteBase::getDroppedEdges(){ return bus.droppedEdges; }
+
+uint16_t AsyncSonyRemoteBase::getQueueHighWaterMark(){ return bus.queueHighWaterMark; }
+uint16_t AsyncSonyRemoteBase::getDroppedMessages(){ return bus.droppedMessages; }
+ul AsyncSonyRemoteBase::getBitThreshold(){ return bus.bitClassifier.getThreshold(); }
+
+void AsyncSonyRemoteBase::getTelemetry(BusTelemetry &snapshot){
+  SonyRemote::getTelemetry(snapshot);
+  uint32_t version;
+  do{
+    version = bus.telemetryVersion;
+    SPSC_BARRIER();
+    memcpy(snapshot.resets, bus.busTelemetry.resets, sizeof(snapshot.resets));
+    memcpy(snapshot.pulses, bus.busTelemetry.pulses, sizeof(snapshot.pulses));
+    snapshot.outboundSent = bus.busTelemetry.outboundSent;
+    snapshot.outboundExpired = bus.busTelemetry.outboundExpired;
+    SPSC_BARRIER();
+  }while(version != bus.telemetryVersion); // An edge came in while copying
+  snapshot.queueOverflows = bus.droppedMessages;
 }
@@ -0,0 +1,63 @@
+#include "binlog.h"
+#include "timebase.h"
+
+#ifdef ARDUINO_ARCH_SAMD
+// Masks interrupts only for the ~20 cycles it takes to copy one record.
+#define BINLOG_LOCK() uint32_t primask = __get_PRIMASK(); __disable_irq()
+#define BINLOG_UNLOCK() __set_PRIMASK(primask)
+#else
+// Host tools may decode on several threads at once.
+#include <mutex>
+static std::recursive_mutex binlogMutex;
+#define BINLOG_LOCK() std::lock_guard<std::recursive_mutex> binlogGuard(binlogMutex)
+#define BINLOG_UNLOCK()
+#endif
+
+namespace binlog{
+  LogRecord records[BINLOG_LENGTH];
+  volatile uint16_t head = 0; // Any context, under BINLOG_LOCK
+  volatile uint16_t tail = 0; // flush() only
+  volatile uint16_t lost = 0;
+
+  void log(LogId id, uint16_t a, uint32_t b){
+    uint32_t time = timebase::now();
+    BINLOG_LOCK();
+    uint16_t h = head;
+    if((uint16_t)(h - tail) < BINLOG_LENGTH){
+      LogRecord &record = records[h & (BINLOG_LENGTH - 1)];
+      record.magic = BINLOG_MAGIC;
+      record.id = static_cast<uint8_t>(id);
+      record.a = a;
+      record.b = b;
+      record.time = time;
+      head = h + 1;
+    }else{
+      lost = lost + 1;
+    }
+    BINLOG_UNLOCK();
+  }
+
+  void logText(LogId id, uint16_t a, const char *text, uint8_t length){
+    log(id, a, length);
+    for(uint8_t i = 0; i<length; i += 4){
+      uint32_t chars = 0;
+      for(uint8_t j = 0; j<4 && i + j < length; j++) chars |= (uint32_t)(uint8_t) text[i + j] << (8 * j);
+      log(LogId::LCD_CHARS, i, chars);
+    }
+  }
+
+  void flush(){
+    if(lost){
+      BINLOG_LOCK();
+      uint16_t count = lost;
+      lost = 0;
+      BINLOG_UNLOCK();
+      log(LogId::LOG_OVERFLOW, count);
+    }
+    while(tail != head && SerialUSB.availableForWrite() >= (int) sizeof(LogRecord)){
+      LogRecord record = records[tail & (BINLOG_LENGTH - 1)];
+      tail = tail + 1;
+      SerialUSB.write((const uint8_t *) &record, sizeof(LogRecord));
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#define BINLOG_LENGTH 128 /*Records, power of two*/
+#define BINLOG_MAGIC 0xb7 /*First byte of every record on the wire - lets the reader resync*/
+
+/*
+  Deferred binary logging. log() copies a 12 byte record into a RAM ring and returns -
+  safe from the bus ISR. flush() runs in the main loop and writes whole records to
+  SerialUSB, only as many as fit without blocking. tools/binlogdump formats them.
+*/
+
+// Append only - the host tool decodes by number.
+enum class LogId : uint8_t{
+  BOOT = 1,           // -
+  BUS_RESET,          // a: ResetReason (REMOTE_DEBUG only)
+  CHECKSUM_ERROR,     // a: xor of the message, b: first 4 bytes
+  QUEUE_OVERFLOW,     // a: dropped messages so far
+  UNKNOWN_PACKET,     // a: packet type, b: bytes dropped
+  UNKNOWN_CAPABILITY, // a: requested block
+  LCD_TEXT,           // a: LCDDataType, b: length (characters follow as LCD_CHARS)
+  LCD_CHARS,          // a: offset, b: 4 characters, first in the low byte
+  UNKNOWN_LCD,        // a: LCDDataType
+  TRACK_NUMBER,       // a: track
+  BUTTON_DEQUEUE,     // a: queue length, b: Button
+  BUTTON_UP,          // -
+  BUTTON_DOWN,        // -
+  LOG_OVERFLOW,       // a: records lost since the last flush
+  REMOTE_MESSAGE,     // a: remote header, b: 11 (frame bytes follow as LCD_CHARS) - passive sniffing
+  PIN_MISMATCH,       // a: Arduino pin, b: port << 8 | bit from the board's pin table (FastPin::begin)
+  ID_COUNT
+};
+
+struct LogRecord{
+  uint8_t magic;
+  uint8_t id;
+  uint16_t a;
+  uint32_t b;
+  uint32_t time; // timebase::now()
+};
+
+namespace binlog{
+  void log(LogId id, uint16_t a = 0, uint32_t b = 0);
+  void logText(LogId id, uint16_t a, const char *text, uint8_t length);
+  void flush();
+}
@@ -0,0 +1,52 @@
+#include "bitclassifier.h"
+
+BitClassifier::BitClassifier(unsigned long lowMin, unsigned long lowMax, unsigned long thresholdMin, unsigned long thresholdMax) : 
+  threshold(lowMax), 
+  lowMin(lowMin), 
+  thresholdMin(thresholdMin), 
+  thresholdMax(thresholdMax){
+  for(uint8_t i = 0; i<PULSE_HISTOGRAM_BINS; i++) histogram[i] = 0;
+}
+
+unsigned long BitClassifier::getThreshold(){ return threshold; }
+
+void BitClassifier::recalibrate(){
+  if(samples < PULSE_HISTOGRAM_WINDOW) return;
+  samples = 0;
+
+  // Snapshot and decay. An increment from the ISR racing with this is simply lost.
+  uint16_t counts[PULSE_HISTOGRAM_BINS];
+  for(uint8_t i = 0; i<PULSE_HISTOGRAM_BINS; i++){
+    counts[i] = histogram[i];
+    histogram[i] = counts[i] >> 1;
+  }
+
+  // Two-cluster isodata: split in the middle of the observed widths, move the split to the
+  // middle of both clusters' means, repeat.
+  uint8_t firstBin = (lowMin >> PULSE_HISTOGRAM_SHIFT) + 1;
+  uint8_t lowest = PULSE_HISTOGRAM_BINS, highest = 0;
+  for(uint8_t i = firstBin; i<PULSE_HISTOGRAM_BINS; i++){
+    if(!counts[i]) continue;
+    if(i < lowest) lowest = i;
+    highest = i;
+  }
+  if(lowest >= highest) return; // Only one kind of bit seen - nothing to separate
+  unsigned long current = ((unsigned long) (lowest + highest + 1) << PULSE_HISTOGRAM_SHIFT) / 2;
+  for(uint8_t iteration = 0; iteration<8; iteration++){
+    uint32_t count[2] = { 0, 0 };
+    uint32_t total[2] = { 0, 0 };
+    for(uint8_t i = firstBin; i<PULSE_HISTOGRAM_BINS; i++){
+      unsigned long centre = (i << PULSE_HISTOGRAM_SHIFT) + (1 << (PULSE_HISTOGRAM_SHIFT - 1));
+      uint8_t side = centre >= current;
+      count[side] += counts[i];
+      total[side] += counts[i] * centre;
+    }
+    if(!count[0] || !count[1]) return;
+    unsigned long next = (total[0] / count[0] + total[1] / count[1]) / 2;
+    if(next == current) break;
+    current = next;
+  }
+  if(current < thresholdMin) current = thresholdMin;
+  if(current > thresholdMax) current = thresholdMax;
+  threshold = current;
+}
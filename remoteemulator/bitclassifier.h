@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PULSE_HISTOGRAM_SHIFT 3 /*8us per bin - no divide on the M0+*/
+#define PULSE_HISTOGRAM_BINS 80 /*Covers 0 - 640us, presync / reset pulses fall off the end*/
+#define PULSE_HISTOGRAM_WINDOW 512 /*Data bits between recalibrations. The histogram is halved each time so old timing fades out.*/
+
+/*
+  Decides 0 / 1 from the length of a data bit's low pulse.
+  A 0 is a pulse inside (lowMin, threshold). The threshold starts at the static
+  DATABIT_LOW_RANGE upper bound and then follows the middle between the short and
+  long clusters of the observed pulse widths, clamped to DATABIT_THRESHOLD_RANGE.
+  That range is wider than DATABIT_LOW_RANGE on purpose: the static window is what one
+  player sent, and a slower one has its 0s beyond it (tools/calibrationsim.cpp). The
+  clamp only keeps a histogram of garbage from moving the threshold into the 1s.
+*/
+class BitClassifier{
+  public:
+  BitClassifier(unsigned long lowMin, unsigned long lowMax, unsigned long thresholdMin, unsigned long thresholdMax);
+
+  // Called for every data bit - from the edge ISR in the async remote.
+  inline bool toBit(unsigned long duration){
+    observe(duration);
+    return !(duration > lowMin && duration < threshold);
+  }
+
+  // Bits whose value is already known (the remote header) still feed the histogram.
+  inline void observe(unsigned long duration){
+    unsigned long bin = duration >> PULSE_HISTOGRAM_SHIFT;
+    if(bin < PULSE_HISTOGRAM_BINS) histogram[bin] = histogram[bin] + 1;
+    samples = samples + 1;
+  }
+
+  // Main loop only.
+  void recalibrate();
+  unsigned long getThreshold();
+
+  protected:
+  volatile uint16_t histogram[PULSE_HISTOGRAM_BINS];
+  volatile uint16_t samples = 0;
+  volatile unsigned long threshold;
+  unsigned long lowMin;
+  unsigned long thresholdMin;
+  unsigned long thresholdMax;
+};
@@ -0,0 +1,98 @@
+#include "busbridge.h"
+
+#ifdef ASYNC_DEFERRED_DECODING
+#error The bridge needs the framing state in the edge ISR - disable ASYNC_DEFERRED_DECODING
+#endif
+
+bool BusBridgeBase::rewritesBit(bool level){
+  if(level == HIGH) return timingBit;
+  uint8_t offset = bus.getBitOffset();
+  timingBit = bus.getState() == TransmitState::PLAYER_SENDING && (rewrittenBytes & (1 << (offset >> 3)));
+  if(timingBit){
+    bool b = rewritten[offset >> 3] & (1 << (offset & 0b111));
+    remoteTimer->pulse(b ? BRIDGE_REWRITE_ONE : BRIDGE_REWRITE_ZERO);
+  }
+  return timingBit;
+}
+
+void BusBridgeBase::handlePlayerEdge(bool level){
+  bus.handleEdge(level);
+  if(level == LOW) return;
+  timingBit = false;
+
+  // Ask for the next byte once the previous one is complete
+  if(bus.getState() != TransmitState::PLAYER_SENDING) return;
+  uint8_t offset = bus.getBitOffset();
+  if(offset & 0b111) return;
+  uint8_t index = offset >> 3;
+  const volatile uint8_t *message = bus.getMessageBuffer();
+  if(!index) rewrittenBytes = 0;
+  if(index < 10){
+    PlayerRewrite hook = rewrite;
+    int16_t replacement = hook ? hook(message, index) : -1;
+    if(replacement < 0) return;
+    rewritten[index] = replacement;
+    rewrittenBytes |= 1 << index;
+  }else if(rewrittenBytes){
+    uint8_t sum = 0;
+    for(uint8_t i = 0; i<10; i++) sum ^= rewrittenBytes & (1 << i) ? rewritten[i] : message[i];
+    rewritten[10] = sum;
+    rewrittenBytes |= 1 << 10;
+    rewrittenMessages = rewrittenMessages + 1;
+  }
+}
+
+void BusBridgeBase::handleRemoteEdge(bool level, bool playerLevel){
+  ul time = timebase::now();
+  if(level == LOW && playerLevel == HIGH){
+    // The remote stretches the player's next low - unless an injected message has the bus
+    if(bus.isSending()){
+      droppedBits = droppedBits + 1;
+    }else{
+      bus.pulseTimer->pulse(DATA_DURATION);
+      forwardedBits = forwardedBits + 1;
+    }
+  }
+  remoteBus.decodeEdge(level, time);
+}
+
+BusBridgeBase::BusBridgeBase(PulseTimer *playerTimer, PulseTimer *remoteTimer) : AsyncSonyRemoteBase(playerTimer){
+  this->remoteTimer = remoteTimer;
+  remoteBus.passive = true;
+  // The real remote's header bits are forwarded, we only announce our own messages
+  bus.isReadyForText = false;
+  bus.isInitialized = false;
+}
+
+void BusBridgeBase::begin(uint8_t playerPin, void (*playerIsr)(), uint8_t remotePin, void (*remoteIsr)()){
+  remoteTimer->begin();
+  AsyncSonyRemoteBase::begin(playerPin, playerIsr);
+  attachInterrupt(digitalPinToInterrupt(remotePin), remoteIsr, CHANGE);
+}
+
+bool BusBridgeBase::handleMessage(){
+  if(AsyncSonyRemoteBase::handleMessage()) return true;
+  remoteBus.bitClassifier.recalibrate();
+  BusDecoder::Message *message;
+  while((message = remoteBus.messageQueue.front())){
+    // Player messages were already handled on the player's side
+    bool fromRemote = message->direction == BusDirection::REMOTE;
+    if(fromRemote) handleRemoteMessage(message->data, message->header, message->time);
+    remoteBus.messageQueue.drop();
+    if(fromRemote) return true;
+  }
+  return false;
+}
+
+void BusBridgeBase::setAnswerCapabilities(bool enabled){
+  answerCapabilities = enabled;
+}
+
+void BusBridgeBase::setRewrite(PlayerRewrite rewrite){
+  this->rewrite = rewrite;
+}
+
+void BusBridgeBase::finaliseOutboundMessage(OutboundPriority priority){
+  if(answerCapabilities) AsyncSonyRemoteBase::finaliseOutboundMessage(priority);
+  else discardOutboundMessage(); // The real remote answers
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "sonyremote.h"
+
+#define BRIDGE_REWRITE_ZERO 180 /*us - rewritten bits towards the remote*/
+#define BRIDGE_REWRITE_ONE 330  /*us - has to end before the player's next low (zero + gap = ~380us)*/
+
+/*
+  Rewrites a player message on its way to the remote. Runs in the player's edge ISR
+  before byte 'index' (0 - 9) goes out, with the player's bytes 0 .. index - 1 already
+  in 'message'. Returns the byte the remote gets instead, or -1 to pass it through.
+  The checksum is fixed up if anything was changed.
+*/
+typedef int16_t (*PlayerRewrite)(const volatile uint8_t *message, uint8_t index);
+
+/*
+  Sits between the player and a real remote, each on their own bus. Everything passes
+  through, the packet handlers see the player's messages and the remote's answers
+  (EventType::REMOTE_MESSAGE) as in passive mode. On top of that the bridge can
+  inject its own messages (sendMessage()), answer capability requests itself and rewrite player
+  messages (e.g. LCD text) while they are being sent.
+  Button presses don't go over the bus - SonyRemoteButtons keeps working as before.
+
+  The player's bus is decoded by 'bus' as usual, the real remote's by remoteBus.
+  Forwarding happens edge by edge:
+  - every low on the player's bus is mirrored onto the remote's, so player bits reach
+    the remote after one ISR latency (or get their width from the rewrite hook)
+  - a fall on the remote's bus while the player's is high is the remote writing a 1,
+    it's answered with the usual DATA_DURATION pulse on the player's bus
+  Both directions add one ISR latency, well inside a bit period (DATA_DURATION). A forwarded
+  1 is shortened by twice that, tools/bridgesim puts the limit at ~45us for a player
+  splitting 180 / 400us lows in the middle.
+*/
+class BusBridgeBase : public AsyncSonyRemoteBase{
+  public:
+  BusBridgeBase(PulseTimer *playerTimer, PulseTimer *remoteTimer);
+
+  // Player messages first, then the remote's. Hides AsyncSonyRemoteBase::handleMessage().
+  bool handleMessage();
+
+  // sendMessage() frames go to the player at its next cedes - a message the remote sends
+  // in the same window is dropped.
+  // Answer capability requests (prepareRemoteCapabilities()) instead of the real remote.
+  void setAnswerCapabilities(bool enabled);
+  void setRewrite(PlayerRewrite rewrite);
+
+  uint32_t getForwardedBits(){ return forwardedBits; }
+  uint32_t getDroppedBits(){ return droppedBits; }
+  uint32_t getRewrittenMessages(){ return rewrittenMessages; }
+
+  protected:
+  void begin(uint8_t playerPin, void (*playerIsr)(), uint8_t remotePin, void (*remoteIsr)());
+  virtual void finaliseOutboundMessage(OutboundPriority priority);
+
+  // Edge ISRs. rewritesBit() is true if the remote's sink is being timed for a rewritten
+  // bit instead of following the player's bus.
+  bool rewritesBit(bool level);
+  void handlePlayerEdge(bool level);
+  void handleRemoteEdge(bool level, bool playerLevel);
+
+  BusDecoder remoteBus;      // Listen-only, the real remote's side
+  PulseTimer *remoteTimer;   // Times rewritten bits on the remote's bus
+  volatile PlayerRewrite rewrite = NULL;
+
+  volatile uint32_t forwardedBits = 0; // Remote -> player
+  volatile uint32_t droppedBits = 0;   // Remote bits overridden by an injected message
+  volatile uint32_t rewrittenMessages = 0;
+
+  // What the remote gets instead of the player's bytes, one bit per byte in rewrittenBytes
+  uint8_t rewritten[11];
+  uint16_t rewrittenBytes = 0;
+  bool timingBit = false;
+
+  bool answerCapabilities = false;
+};
+
+// PlayerPin / RemotePin read the two buses, RemoteSinkPin pulls the remote's low (remoteTimer's pin).
+template<class PlayerPin, class RemotePin, class RemoteSinkPin>
+class BusBridge : public BusBridgeBase{
+  public:
+  BusBridge(PulseTimer *playerTimer, PulseTimer *remoteTimer) : BusBridgeBase(playerTimer, remoteTimer){}
+
+  void begin(){
+    PlayerPin::begin();
+    RemotePin::begin();
+    RemoteSinkPin::begin();
+    instance = this;
+    BusBridgeBase::begin(PlayerPin::pin, playerIsr, RemotePin::pin, remoteIsr);
+  }
+
+  private:
+  static void playerIsr(){
+    bool level = PlayerPin::read();
+    if(!instance->rewritesBit(level)) RemoteSinkPin::write(level == LOW);
+    instance->handlePlayerEdge(level);
+  }
+
+  static void remoteIsr(){
+    instance->handleRemoteEdge(RemotePin::read(), PlayerPin::read());
+  }
+
+  static BusBridge *instance;
+};
+
+template<class PlayerPin, class RemotePin, class RemoteSinkPin>
+BusBridge<PlayerPin, RemotePin, RemoteSinkPin> *BusBridge<PlayerPin, RemotePin, RemoteSinkPin>::instance = NULL;
@@ -0,0 +1,76 @@
+#include "edgecapture.h"
+#include <string.h>
+
+void initEdgeCaptureHeader(EdgeCaptureHeader &header, uint16_t blockSize, uint32_t tickNs){
+  memset(&header, 0, sizeof(header));
+  header.magic = EDGE_CAPTURE_MAGIC;
+  header.version = EDGE_CAPTURE_VERSION;
+  header.blockSize = blockSize;
+  header.tickNs = tickNs;
+}
+
+uint16_t edgeBlockChecksum(const uint8_t *block, uint16_t blockSize){
+  uint16_t sum = 0;
+  for(uint16_t i = 0; i<blockSize; i++) sum += block[i];
+  return sum;
+}
+
+void EdgeBlockEncoder::reset(uint32_t sequence){
+  memset(block, 0, sizeof(EdgeBlockHeader));
+  header()->sequence = sequence;
+  used = sizeof(EdgeBlockHeader);
+}
+
+bool EdgeBlockEncoder::add(bool level, uint64_t time){
+  EdgeBlockHeader *h = header();
+  if(h->edges == 0){
+    h->startTime = time;
+    h->level = level;
+  }else{
+    if(h->edges == 0xffff || used + EDGE_VARINT_MAX > blockSize) return false;
+    uint64_t value = ((time - lastTime) << 1) | (level == lastLevel);
+    while(value >= 0x80){
+      block[used++] = (value & 0x7f) | 0x80;
+      value >>= 7;
+    }
+    block[used++] = value;
+  }
+  h->edges++;
+  lastTime = time;
+  lastLevel = level;
+  return true;
+}
+
+void EdgeBlockEncoder::finish(){
+  memset(block + used, 0, blockSize - used);
+}
+
+EdgeBlockDecoder::EdgeBlockDecoder(const uint8_t *block, uint16_t blockSize) : block(block), blockSize(blockSize){
+  offset = sizeof(EdgeBlockHeader);
+  remaining = block ? getHeader().edges : 0;
+}
+
+bool EdgeBlockDecoder::next(bool &level, uint64_t &time){
+  if(!remaining) return false;
+  if(remaining-- == getHeader().edges){
+    lastTime = getHeader().startTime;
+    lastLevel = getHeader().level;
+  }else{
+    uint64_t value = 0;
+    uint8_t shift = 0, b;
+    do{
+      if(offset >= blockSize || shift > 63){ // Corrupt block
+        remaining = 0;
+        return false;
+      }
+      b = block[offset++];
+      value |= (uint64_t)(b & 0x7f) << shift;
+      shift += 7;
+    }while(b & 0x80);
+    lastTime += value >> 1;
+    lastLevel = (value & 1) ? lastLevel : !lastLevel;
+  }
+  level = lastLevel;
+  time = lastTime;
+  return true;
+}
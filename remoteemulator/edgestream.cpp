@@ -0,0 +1,70 @@
+#include "edgestream.h"
+
+EdgeStreamer::EdgeStreamer(AsyncSonyRemoteBase *remote)
+  : remote(remote), encoder(frame + sizeof(EdgeStreamFrameHeader), EDGE_STREAM_BLOCK_SIZE){}
+
+void EdgeStreamer::start(){
+  sequence = 0;
+  sending = false;
+  time = 0;
+  hasPending = false;
+  encoder.reset(sequence);
+  droppedEdges = remote->getDroppedEdges();
+  remote->setRawCapture(true);
+  lastEdge = blockStart = timebase::now();
+  active = true;
+}
+
+void EdgeStreamer::stop(){
+  remote->setRawCapture(false);
+  active = false;
+}
+
+void EdgeStreamer::finishFrame(){
+  encoder.finish();
+  EdgeStreamFrameHeader *header = (EdgeStreamFrameHeader *) frame;
+  header->magic = EDGE_STREAM_MAGIC;
+  header->blockSize = EDGE_STREAM_BLOCK_SIZE;
+  header->checksum = edgeBlockChecksum(frame + sizeof(EdgeStreamFrameHeader), EDGE_STREAM_BLOCK_SIZE);
+  sending = true;
+  sent = 0;
+}
+
+void EdgeStreamer::poll(){
+  if(!active) return;
+
+  if(!sending){
+    while(hasPending || remote->readRawEdge(pending)){
+      hasPending = true;
+      // Unsigned 32 bit difference - correct across the timebase wrap
+      uint64_t t = time + (uint32_t)(pending.time - lastEdge);
+      if(!encoder.add(pending.level, t)){
+        finishFrame();
+        break;
+      }
+      time = t;
+      lastEdge = pending.time;
+      hasPending = false;
+    }
+    if(!sending && !encoder.isEmpty() && timebase::now() - blockStart > EDGE_STREAM_IDLE_FLUSH) finishFrame();
+    if(!sending) return;
+  }
+
+  // Never block the loop - only write what the USB buffer takes now.
+  int room = SerialUSB.availableForWrite();
+  if(room <= 0) return;
+  uint16_t chunk = sizeof(frame) - sent < (uint16_t) room ? sizeof(frame) - sent : room;
+  SerialUSB.write(frame + sent, chunk);
+  sent += chunk;
+  if(sent < sizeof(frame)) return;
+
+  sending = false;
+  ++sequence;
+  uint16_t dropped = remote->getDroppedEdges();
+  if(dropped != droppedEdges){
+    ++sequence; // Edges were lost - leave a gap the host will report
+    droppedEdges = dropped;
+  }
+  encoder.reset(sequence);
+  blockStart = timebase::now();
+}
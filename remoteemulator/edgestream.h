@@ -0,0 +1,44 @@
+#pragma once
+
+#include "sonyremote.h"
+#include "edgecapture.h"
+
+#define EDGE_STREAM_BLOCK_SIZE 256 /*Bytes - ~120 edges, a frame is a handful of USB packets*/
+#define EDGE_STREAM_IDLE_FLUSH 100000 /*us - sends a partly filled block when the bus goes quiet*/
+#define EDGE_STREAM_START 'C' /*Host -> device: stop being a remote, stream edges*/
+#define EDGE_STREAM_STOP 'R' /*Host -> device: back to remote emulation*/
+
+/*
+  Logic analyzer mode. The remote's ISR keeps timestamping edges but only queues them,
+  poll() packs them into edge capture blocks (edgecapture.h) and writes framed blocks
+  to SerialUSB without blocking. tools/edgerecv stores them as a .edges capture.
+  If the edge queue ever overflows the next block skips a sequence number, so the host
+  sees every loss.
+*/
+class EdgeStreamer{
+  public:
+  EdgeStreamer(AsyncSonyRemoteBase *remote);
+
+  void start();
+  void stop();
+  bool isActive(){ return active; }
+  // Main loop. Must run at least every ~EDGE_QUEUE_LENGTH edges (~50ms of bus traffic).
+  void poll();
+
+  private:
+  void finishFrame();
+
+  AsyncSonyRemoteBase *remote;
+  alignas(8) uint8_t frame[sizeof(EdgeStreamFrameHeader) + EDGE_STREAM_BLOCK_SIZE]; // The block header has 64 bit fields
+  EdgeBlockEncoder encoder;
+  bool active = false;
+  bool sending = false; // A finished frame is being written out
+  uint16_t sent;
+  uint32_t sequence;
+  uint16_t droppedEdges;
+  uint64_t time; // Edge timestamps extended past the 32 bit timebase wrap
+  ul lastEdge;
+  ul blockStart;
+  BusDecoder::Edge pending;
+  bool hasPending = false;
+};
@@ -0,0 +1,76 @@
+#include "eventcoalescer.h"
+
+// EventType, or EVENT_TYPES + n for LCD text. -1 for events that are never coalesced.
+static int8_t coalescingKey(const RemoteEvent &event){
+  switch(event.type){
+    case EventType::NONE:
+    case EventType::REMOTE_MESSAGE:
+    case EventType::NOT_IMPLEMENTED:
+      return -1;
+    case EventType::LCD_TEXT:
+      if(event.data.lcd.type == EventLCDText::LCDDataType::UNKNOWN) return -1;
+      return EVENT_TYPES + static_cast<int8_t>(event.data.lcd.type) - 1;
+    default:
+      return static_cast<int8_t>(event.type);
+  }
+}
+
+EventCoalescer::EventCoalescer(uint16_t dropUnchanged){
+  this->dropUnchanged = dropUnchanged;
+}
+
+void EventCoalescer::reset(){ delivered = 0; }
+
+bool EventCoalescer::isUnchanged(const RemoteEvent &event, int8_t key){
+  if(!(dropUnchanged & EVENT_MASK(event.type)) || !(delivered & (1 << key))) return false;
+  if(key >= EVENT_TYPES) return !strcmp(lastText[key - EVENT_TYPES], event.data.lcd.text);
+  const RemoteEvent &previous = last[key];
+  switch(event.type){
+    case EventType::TRACK_NUMBER:
+      return previous.data.trackNumber.number == event.data.trackNumber.number &&
+        previous.data.trackNumber.indicatorShown == event.data.trackNumber.indicatorShown;
+    case EventType::VOLUME_LEVEL: return previous.data.volume.level == event.data.volume.level;
+    case EventType::BATTERY_LEVEL: return previous.data.battery.level == event.data.battery.level;
+    case EventType::ALARM_INDICATOR: return previous.data.alarm.enabled == event.data.alarm.enabled;
+    case EventType::RECORD_INDICATOR: return previous.data.record.enabled == event.data.record.enabled;
+    case EventType::EQ_INDICATOR: return previous.data.eq.eq == event.data.eq.eq;
+    case EventType::PLAYBACK_MODE: return previous.data.playbackMode.mode == event.data.playbackMode.mode;
+    default: return false;
+  }
+}
+
+void EventCoalescer::remember(const RemoteEvent &event, int8_t key){
+  if(!(dropUnchanged & EVENT_MASK(event.type))) return;
+  if(key >= EVENT_TYPES){
+    strncpy(lastText[key - EVENT_TYPES], event.data.lcd.text, LCD_BUFFER_LENGTH - 1);
+    lastText[key - EVENT_TYPES][LCD_BUFFER_LENGTH - 1] = 0;
+  }else{
+    last[key] = event;
+  }
+  delivered |= 1 << key;
+}
+
+EventSpan EventCoalescer::filter(EventSpan events){
+  // Newest first - whatever comes before an event of the same key is stale
+  uint16_t newer = 0;
+  for(uint8_t i = events.count; i-- > 0;){
+    RemoteEvent &event = events.events[i];
+    int8_t key = coalescingKey(event);
+    if(key < 0) continue;
+    if((newer & (1 << key)) || isUnchanged(event, key)){
+      event.type = EventType::NONE;
+    }else{
+      remember(event, key);
+    }
+    newer |= 1 << key;
+  }
+
+  uint8_t kept = 0;
+  for(uint8_t i = 0; i<events.count; i++){
+    if(events.events[i].type == EventType::NONE) continue;
+    if(kept != i) events.events[kept] = events.events[i];
+    ++kept;
+  }
+  suppressed += events.count - kept;
+  return { events.events, kept };
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "sonyremote.h"
+
+#define COALESCED_LCD_TYPES 3 /*TIME, DISC_TITLE, TRACK_TITLE - UNKNOWN texts always pass*/
+
+/*
+  Sits between drainEvents() and the application and drops events that wouldn't
+  change anything:
+  - of a drained span only the newest event of every type is kept (LCD text: of every
+    LCDDataType), the rest keep their bus order
+  - types in 'dropUnchanged' (EVENT_MASK()s) are also dropped while their value is the
+    one delivered last
+  REMOTE_MESSAGE events always pass.
+*/
+class EventCoalescer{
+  public:
+  EventCoalescer(uint16_t dropUnchanged = 0);
+
+  // Compacts the span in place. The result is valid as long as the drained span.
+  EventSpan filter(EventSpan events);
+  // Forget the delivered values - e.g. after a redraw, so the next ones go through.
+  void reset();
+  uint32_t getSuppressed(){ return suppressed; }
+
+  private:
+  bool isUnchanged(const RemoteEvent &event, int8_t key);
+  void remember(const RemoteEvent &event, int8_t key);
+
+  uint16_t dropUnchanged;
+  uint16_t delivered = 0; // Keys that have a value in last / lastText
+  RemoteEvent last[EVENT_TYPES];
+  char lastText[COALESCED_LCD_TYPES][LCD_BUFFER_LENGTH];
+  uint32_t suppressed = 0;
+};
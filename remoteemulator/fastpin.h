@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "binlog.h"
+
+#ifdef ARDUINO_ARCH_SAMD
+/*
+  Compile-time GPIO - every access is a single PORT register load / store instead of
+  digitalRead()/digitalWrite()'s pin table lookup. ArduinoPin is only used for
+  pinMode() and attachInterrupt(); Port / Bit must match the board's variant.cpp. begin()
+  checks that once - a wrong entry would only read as a silent bus, so it stops there and
+  keeps logging PIN_MISMATCH instead.
+*/
+template<uint8_t ArduinoPin, uint8_t Port, uint8_t Bit>
+struct FastPin{
+  static const uint8_t pin = ArduinoPin;
+
+  static void begin(){
+    const PinDescription &description = g_APinDescription[ArduinoPin];
+    if(description.ulPort == Port && description.ulPin == Bit) return;
+    while(true){
+      binlog::log(LogId::PIN_MISMATCH, ArduinoPin, (description.ulPort << 8) | description.ulPin);
+      binlog::flush();
+      delay(1000);
+    }
+  }
+
+  static inline bool read(){
+    return PORT->Group[Port].IN.reg & (1ul << Bit);
+  }
+
+  static inline void write(bool value){
+    if(value) PORT->Group[Port].OUTSET.reg = (1ul << Bit);
+    else PORT->Group[Port].OUTCLR.reg = (1ul << Bit);
+  }
+};
+#else
+// Host mock - the line level is a plain variable driven by the simulator.
+template<uint8_t ArduinoPin>
+struct HostPin{
+  static const uint8_t pin = ArduinoPin;
+  static volatile bool level;
+
+  static inline void begin(){}
+  static inline bool read(){ return level; }
+  static inline void write(bool value){ level = value; }
+};
+
+template<uint8_t ArduinoPin>
+volatile bool HostPin<ArduinoPin>::level = HIGH;
+#endif
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+  Compile-time packet layouts. A packet is its type byte followed by named fields:
+
+    struct Level : PacketField<1>{};
+    typedef PacketSchema<0x40, Level> VolumePacket;
+
+  Field offsets and the packet length are constants, so PacketReader::get() is a
+  plain byte load, and ConstantFrame builds a whole frame (checksum included) while
+  compiling. Everything is C++11 - the SAMD core doesn't build with anything newer.
+*/
+
+template<uint8_t Length>
+struct PacketField{
+  static constexpr uint8_t length = Length;
+};
+
+// Bytes nothing reads (yet)
+template<uint8_t Length>
+struct PacketPadding : PacketField<Length>{};
+
+template<class... Fields>
+struct PacketFieldsLength{
+  static constexpr uint8_t value = 0;
+};
+
+template<class First, class... Rest>
+struct PacketFieldsLength<First, Rest...>{
+  static constexpr uint8_t value = First::length + PacketFieldsLength<Rest...>::value;
+};
+
+// A field that isn't part of the packet fails here (incomplete type)
+template<class Field, class... Fields>
+struct PacketFieldOffset;
+
+template<class Field, class... Rest>
+struct PacketFieldOffset<Field, Field, Rest...>{
+  static constexpr uint8_t value = 0;
+};
+
+template<class Field, class First, class... Rest>
+struct PacketFieldOffset<Field, First, Rest...>{
+  static constexpr uint8_t value = First::length + PacketFieldOffset<Field, Rest...>::value;
+};
+
+template<uint8_t Type, class... Fields>
+struct PacketSchema{
+  static constexpr uint8_t type = Type;
+  static constexpr uint8_t length = PacketFieldsLength<Fields...>::value; // Bytes after the type byte
+  static_assert(length < 10, "A packet has to fit into the 10 payload bytes of a frame");
+
+  // Offset of the field after the type byte
+  template<class Field>
+  struct offset{
+    static constexpr uint8_t value = PacketFieldOffset<Field, Fields...>::value;
+  };
+};
+
+/*
+  Zero-copy view of a packet inside a received frame. 'available' is what's left of the
+  frame - fields cut off by its end read as 0, like FrameReader::next().
+*/
+template<class Schema>
+class PacketReader{
+  public:
+  PacketReader(const uint8_t *data, uint8_t available) : data(data), available(available){}
+
+  template<class Field>
+  inline uint8_t get(uint8_t index = 0) const {
+    uint8_t offset = Schema::template offset<Field>::value + index;
+    return offset < available ? data[offset] : 0;
+  }
+
+  private:
+  const uint8_t *data;
+  uint8_t available;
+};
+
+// A field's value in a ConstantFrame. Multi-byte fields only get their first byte set.
+template<class Field, uint8_t Value>
+struct PacketValue{};
+
+template<class Schema, class... Values>
+struct PacketFrameByte{
+  static constexpr uint8_t at(uint8_t){ return 0; }
+};
+
+template<class Schema, class Field, uint8_t Value, class... Rest>
+struct PacketFrameByte<Schema, PacketValue<Field, Value>, Rest...>{
+  static constexpr uint8_t at(uint8_t index){
+    return index == 1 + Schema::template offset<Field>::value ? Value : PacketFrameByte<Schema, Rest...>::at(index);
+  }
+};
+
+/*
+  An 11 byte frame that never changes - one packet, the rest zeros, and the checksum,
+  all worked out by the compiler:
+
+    typedef ConstantFrame<VolumePacket, PacketValue<Level, 30>> FullVolume;
+    send(FullVolume::bytes);
+*/
+template<class Schema, class... Values>
+struct ConstantFrame{
+  static constexpr uint8_t byte(uint8_t index){
+    return index == 0 ? Schema::type : PacketFrameByte<Schema, Values...>::at(index);
+  }
+  static constexpr uint8_t checksum(uint8_t index = 0){
+    return index == 10 ? 0 : byte(index) ^ checksum(index + 1);
+  }
+
+  static constexpr uint8_t bytes[11] = {
+    byte(0), byte(1), byte(2), byte(3), byte(4), byte(5), byte(6), byte(7), byte(8), byte(9), checksum()
+  };
+};
+
+template<class Schema, class... Values>
+constexpr uint8_t ConstantFrame<Schema, Values...>::bytes[11];
@@ -0,0 +1,69 @@
+#include "pulsetimer.h"
+#include "timebase.h"
+
+PulseTimer::~PulseTimer(){}
+
+#ifdef ARDUINO_ARCH_SAMD
+
+static SAMDPulseTimer *channels[2];
+
+static inline void syncTC3(){
+  while(TC3->COUNT16.STATUS.bit.SYNCBUSY);
+}
+
+SAMDPulseTimer::SAMDPulseTimer(uint8_t pin, uint8_t channel) : 
+  pin(pin), 
+  channel(channel){}
+
+void SAMDPulseTimer::begin(){
+  channels[channel] = this;
+  uint8_t port = g_APinDescription[pin].ulPort;
+  mask = 1ul << g_APinDescription[pin].ulPin;
+  outSet = &PORT->Group[port].OUTSET.reg;
+  outClear = &PORT->Group[port].OUTCLR.reg;
+  *outClear = mask;
+  if(TC3->COUNT16.CTRLA.bit.ENABLE) return; // Started by the other channel
+
+  timebase::routeMicrosecondClock(GCLK_CLKCTRL_ID_TCC2_TC3);
+  PM->APBCMASK.reg |= PM_APBCMASK_TC3;
+
+  TC3->COUNT16.CTRLA.reg = TC_CTRLA_SWRST;
+  while(TC3->COUNT16.CTRLA.bit.SWRST);
+  TC3->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_NFRQ | TC_CTRLA_PRESCALER_DIV1;
+  syncTC3();
+  // Keep COUNT continuously synchronised so pulse() can read it without waiting
+  TC3->COUNT16.READREQ.reg = TC_READREQ_RCONT | TC_READREQ_ADDR(TC_COUNT16_COUNT_OFFSET);
+
+  NVIC_SetPriority(TC3_IRQn, 0);
+  NVIC_EnableIRQ(TC3_IRQn);
+  TC3->COUNT16.CTRLA.bit.ENABLE = 1;
+  syncTC3();
+}
+
+void SAMDPulseTimer::pulse(uint16_t duration){
+  *outSet = mask;
+  pulsing = true;
+  TC3->COUNT16.CC[channel].reg = TC3->COUNT16.COUNT.reg + duration;
+  TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_MC(1 << channel);
+  TC3->COUNT16.INTENSET.reg = TC_INTENSET_MC(1 << channel);
+}
+
+bool SAMDPulseTimer::isPulsing(){ return pulsing; }
+
+void SAMDPulseTimer::release(){
+  *outClear = mask;
+  pulsing = false;
+}
+
+void TC3_Handler(){
+  uint8_t pending = TC3->COUNT16.INTFLAG.reg & TC3->COUNT16.INTENSET.reg;
+  for(uint8_t ch = 0; ch<2; ch++){
+    uint8_t flag = TC_INTFLAG_MC(1 << ch);
+    if(!(pending & flag)) continue;
+    TC3->COUNT16.INTENCLR.reg = flag;
+    TC3->COUNT16.INTFLAG.reg = flag;
+    if(channels[ch]) channels[ch]->release();
+  }
+}
+
+#endif
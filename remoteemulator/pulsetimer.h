@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <Arduino.h>
+
+/*
+  Generates the remote's outbound bit pulses: pulse() drives the pin HIGH and returns
+  immediately, the pin is released by the timer once 'duration' microseconds have passed.
+*/
+class PulseTimer{
+  public:
+  virtual ~PulseTimer();
+  virtual void begin() = 0;
+  virtual void pulse(uint16_t duration) = 0;
+  virtual bool isPulsing() = 0;
+};
+
+#ifdef ARDUINO_ARCH_SAMD
+// TC3 free-running at 1MHz, each pin gets one of its two compare channels.
+class SAMDPulseTimer : public PulseTimer{
+  public:
+  SAMDPulseTimer(uint8_t pin, uint8_t channel = 0);
+  virtual void begin();
+  virtual void pulse(uint16_t duration);
+  virtual bool isPulsing();
+  void release();
+
+  protected:
+  uint8_t pin;
+  uint8_t channel;
+  volatile bool pulsing = false;
+  // Resolved once in begin() - pulse() runs in the edge ISR.
+  volatile uint32_t *outSet;
+  volatile uint32_t *outClear;
+  uint32_t mask;
+};
+#else
+// Host stand-in - the pulse ends once the (simulated) micros() clock passes its deadline.
+class SimulatedPulseTimer : public PulseTimer{
+  public:
+  virtual void begin(){}
+  virtual void pulse(uint16_t duration){
+    releaseTime = micros() + duration;
+    pulsing = true;
+    ++pulses;
+  }
+  virtual bool isPulsing(){
+    if(pulsing && (long)(micros() - releaseTime) >= 0) pulsing = false;
+    return pulsing;
+  }
+
+  uint32_t pulses = 0;
+
+  private:
+  unsigned long releaseTime;
+  bool pulsing = false;
+};
+#endif
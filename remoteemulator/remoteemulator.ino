@@ -5,9 +5,24 @@
 #include "bitmaps.h"
 #include "sonyremote.h"
 #include "sonyremote-buttons.h"
+#include "binlog.h"
+#include "edgestream.h"
+#include "busbridge.h"
+#include "eventcoalescer.h"
+
+//#define PASSIVE_SNIFFER /*Next to a real remote: decode both directions, never drive the bus or the buttons*/
+//#define BUS_BRIDGE /*Between the player and a real remote on REMOTE_SIGNAL_PIN / REMOTE_SINK_PIN*/
+
+#define CAPABILITY_PROFILE CapabilityProfile::KANJI /*What the player is told the remote can show. NARROW_TEXT: shorter LCD text*/
 
 #define SIGNAL_PIN 3
 #define SIGNAL_SINK_PIN 2
+typedef FastPin<SIGNAL_PIN, PORTA, 9> SignalPin; // D3 is PA09 on the Zero
+
+#define REMOTE_SIGNAL_PIN 10
+#define REMOTE_SINK_PIN 11
+typedef FastPin<REMOTE_SIGNAL_PIN, PORTA, 18> RemoteSignalPin; // D10 is PA18
+typedef FastPin<REMOTE_SINK_PIN, PORTA, 16> RemoteSinkPin;     // D11 is PA16
 
 #define UP_PIN 7
 #define DOWN_PIN 6
@@ -39,7 +54,17 @@ typedef unsigned long int ul;
 UiToolkit toolkit(SCREEN_WIDTH, SCREEN_HEIGHT);
 WireFast1306 screen(&Wire, OLED_ADDRESS);
 
-AsyncSonyRemote remote(SIGNAL_PIN, SIGNAL_SINK_PIN);
+SAMDPulseTimer pulseTimer(SIGNAL_SINK_PIN);
+#ifdef BUS_BRIDGE
+SAMDPulseTimer remotePulseTimer(REMOTE_SINK_PIN, 1);
+BusBridge<SignalPin, RemoteSignalPin, RemoteSinkPin> remote(&pulseTimer, &remotePulseTimer);
+#else
+AsyncSonyRemote<SignalPin> remote(&pulseTimer);
+#endif
+EdgeStreamer edgeStreamer(&remote);
+// The player keeps repeating the volume - only changes get redrawn. LCD time and track numbers
+// also show the display is still cycling (see handleCommunication()), they're only collapsed.
+EventCoalescer coalescer(EVENT_MASK(EventType::VOLUME_LEVEL));
 SonyRemoteButtonsMCP4561 buttonsEmu(MCP4561_ADDRESS);
 volatile bool interrupted = false;
 
@@ -73,7 +98,7 @@ inline void setupState(){
 
 inline void setupDebug(){
   Serial.begin(9600);
-  Serial.println("Hello");
+  binlog::log(LogId::BOOT);
   pinMode(9, OUTPUT);
   pinMode(8, OUTPUT);
   strcpy(trackTitle, "Very Long Test Track");
@@ -83,8 +108,20 @@ inline void setupDebug(){
 
 inline void setupRemote(){
   pinMode(SIGNAL_PIN, INPUT);
+  #ifdef PASSIVE_SNIFFER
+  remote.setPassive(true); // The sink pin stays an input
+  #else
   pinMode(SIGNAL_SINK_PIN, OUTPUT);
   buttonsEmu.begin();
+  #endif
+  #ifdef BUS_BRIDGE
+  pinMode(REMOTE_SIGNAL_PIN, INPUT);
+  pinMode(REMOTE_SINK_PIN, OUTPUT);
+  #endif
+  // Only what handleCommunication() acts on - the indicators are skipped in the parser
+  remote.setSubscriptions(EVENT_MASK(EventType::LCD_TEXT) | EVENT_MASK(EventType::TRACK_NUMBER) |
+    EVENT_MASK(EventType::VOLUME_LEVEL) | EVENT_MASK(EventType::REMOTE_MESSAGE));
+  remote.setCapabilityProfile(CAPABILITY_PROFILE);
   remote.begin();
 
   pinMode(UP_PIN, INPUT_PULLUP);
@@ -96,7 +133,6 @@ inline void setupRemote(){
 
 
 void setup() {
-  NVIC_SetPriority(SysTick_IRQn, 0);
   setupScreen();
   setupState();
   setupDebug();
@@ -271,75 +307,79 @@ ul lastChangeTime = 0;
 
 uint8_t handleCommunication(EventType *typesRead = NULL){
   uint8_t eventTypeCounter = 0;
+  bool received = false;
   while(remote.handleMessage()){
-    RemoteEvent *event;
-    if(remote.hasChecksumError()){
-      Serial.println("Checksum error");
-      return 0;
-    }
-    while(event = remote.nextEvent()){  
-      if(typesRead) typesRead[eventTypeCounter++] = event->type;
-      switch(event->type){
-        case EventType::LCD_TEXT:
-          switch(event->data.lcd.type){
-            case EventLCDText::LCDDataType::TIME:
-              currentTime = event->data.lcd.text;
-              lastLCDUpdateTime = micros();
-              timeSignalPromised = false;
-              drawCurrentTime();
-              break;
-            case EventLCDText::LCDDataType::TRACK_TITLE:
-              strcpy(trackTitle, event->data.lcd.text);
-              initScrollParameters();
-              currentTrackScroll = -SCROLL_TICK_DISTANCE; //Start scrolling immediately
-              drawTrackTitle();
-              hasTrackTitle = true;
-              break;
-            case EventLCDText::LCDDataType::DISC_TITLE:
-              strcpy(discTitle, event->data.lcd.text);
-              initScrollParameters();
-              currentDiscScroll = -SCROLL_TICK_DISTANCE; //Start scrolling immediately
-              drawDiscTitle();
-              hasDiscTitle = true;
-              break;
-            default:
-              SerialUSB.print("Unknown LCD: ");
-              SerialUSB.println(static_cast<uint8_t>(event->data.lcd.type));
-              break;
-          }
-          break;
-        case EventType::VOLUME_LEVEL:
-          volume = (100 * ((uint16_t) event->data.volume.level)) / 30;
-          drawVolumeValue();
-          break;
-        case EventType::TRACK_NUMBER:
-          Serial.print("Track: ");
-          Serial.println(event->data.trackNumber.number);
-          if((micros() - lastLCDUpdateTime) < 500000) {
-            currentTrack = event->data.trackNumber.number;
+    received = true;
+    if(remote.hasChecksumError()) binlog::log(LogId::CHECKSUM_ERROR); // Its events were dropped
+  }
+  if(!received) return 0;
+  // Everything since the last loop(), in bus order, repeated values collapsed
+  EventSpan events = coalescer.filter(remote.drainEvents());
+  for(RemoteEvent *event = events.begin(); event != events.end(); ++event){
+    if(typesRead) typesRead[eventTypeCounter++] = event->type;
+    switch(event->type){
+      case EventType::LCD_TEXT:
+        switch(event->data.lcd.type){
+          case EventLCDText::LCDDataType::TIME:
+            currentTime = event->data.lcd.text;
+            lastLCDUpdateTime = micros();
+            timeSignalPromised = false;
             drawCurrentTime();
-          }
-          break;
-      }
-    }
-    buttonsEmu.tick();
-    if(timeSignalPromised && (micros() - lastLCDUpdateTime) > 30*SEC){
-      // Something is wrong - track switched when in alternative DISPLAY?
-      timeSignalPromised = false; // unlock - force switch the display.
-    }
-    // TODO: Rewrite this:
-    if(((micros() - lastLCDUpdateTime) > 2*SEC || !hasDiscTitle ||!hasTrackTitle) && (micros() - lastChangeTime) > 2*SEC && !timeSignalPromised){
-      buttonsEmu.sendButton(Button::DISPLAY_SWITCH);
-      lastChangeTime = micros();
+            break;
+          case EventLCDText::LCDDataType::TRACK_TITLE:
+            strcpy(trackTitle, event->data.lcd.text);
+            initScrollParameters();
+            currentTrackScroll = -SCROLL_TICK_DISTANCE; //Start scrolling immediately
+            drawTrackTitle();
+            hasTrackTitle = true;
+            break;
+          case EventLCDText::LCDDataType::DISC_TITLE:
+            strcpy(discTitle, event->data.lcd.text);
+            initScrollParameters();
+            currentDiscScroll = -SCROLL_TICK_DISTANCE; //Start scrolling immediately
+            drawDiscTitle();
+            hasDiscTitle = true;
+            break;
+          default:
+            binlog::log(LogId::UNKNOWN_LCD, static_cast<uint8_t>(event->data.lcd.type));
+            break;
+        }
+        break;
+      case EventType::VOLUME_LEVEL:
+        volume = (100 * ((uint16_t) event->data.volume.level)) / 30;
+        drawVolumeValue();
+        break;
+      case EventType::TRACK_NUMBER:
+        binlog::log(LogId::TRACK_NUMBER, event->data.trackNumber.number);
+        if((micros() - lastLCDUpdateTime) < 500000) {
+          currentTrack = event->data.trackNumber.number;
+          drawCurrentTime();
+        }
+        break;
+      case EventType::REMOTE_MESSAGE:
+        binlog::logText(LogId::REMOTE_MESSAGE, event->data.remoteMessage.header, (const char *) event->data.remoteMessage.data, 11);
+        break;
     }
   }
+  #ifndef PASSIVE_SNIFFER
+  buttonsEmu.tick();
+  if(timeSignalPromised && (micros() - lastLCDUpdateTime) > 30*SEC){
+    // Something is wrong - track switched when in alternative DISPLAY?
+    timeSignalPromised = false; // unlock - force switch the display.
+  }
+  // TODO: Rewrite this:
+  if(((micros() - lastLCDUpdateTime) > 2*SEC || !hasDiscTitle ||!hasTrackTitle) && (micros() - lastChangeTime) > 2*SEC && !timeSignalPromised){
+    buttonsEmu.sendButton(Button::DISPLAY_SWITCH);
+    lastChangeTime = micros();
+  }
+  #endif
   return eventTypeCounter;
 }
 
 /*********************************UI Updating*********************************/
 
 void pinDownISR(){
-  Serial.println("DOWN");
+  binlog::log(LogId::BUTTON_DOWN);
   switch(programState){
     case MainState::HOME:
       buttonsEmu.clearQueue();
@@ -351,7 +391,7 @@ void pinDownISR(){
 }
 
 void pinUpISR(){
-  Serial.println("UP");
+  binlog::log(LogId::BUTTON_UP);
   switch(programState){
     case MainState::HOME:
       buttonsEmu.clearQueue();
@@ -380,8 +420,30 @@ inline void switchStates(){
   awaitingSwitch = MainState::NONE;
 }
 
+// The host switches between remote emulation and logic analyzer mode (tools/edgerecv).
+void handleSerialCommands(){
+  while(Serial.available()){
+    switch(Serial.read()){
+      case EDGE_STREAM_START:
+        edgeStreamer.start();
+        break;
+      case EDGE_STREAM_STOP:
+        edgeStreamer.stop();
+        break;
+    }
+  }
+}
+
 void loop() {
+  handleSerialCommands();
+  if(edgeStreamer.isActive()){
+    // Nothing else runs - a display refresh would stall the stream for ~25ms
+    edgeStreamer.poll();
+    return;
+  }
+
   handleCommunication();
+  binlog::flush();
 
   if(toolkit.hasPendingAnimations()){
     screen.beginDelta();
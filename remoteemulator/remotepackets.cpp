@@ -1,43 +1,72 @@
 #include "sonyremote.h"
+#include "remotepackets.h"
+#include "binlog.h"
+
+using namespace packets;
+
+/*
+  Player packets: layout (remotepackets.h), the event it makes (its subscription) and
+  the handler. A new packet type is its schema plus one line here. A type with a known
+  layout but no handler (NULL) is stepped over without losing the rest of the frame.
+*/
+#define PLAYER_PACKETS(PACKET) \
+  PACKET(RequestCapabilities,   NONE,             &SonyRemote::handleRequestRemoteCapabilitiesPacket) \
+  PACKET(ClearLCDRegisters,     NONE,             &SonyRemote::handleClearLCDRegisters) \
+  PACKET(VolumeIndicator,       VOLUME_LEVEL,     &SonyRemote::handleVolumeIndicatorPacket) \
+  PACKET(PlaybackModeIndicator, PLAYBACK_MODE,    &SonyRemote::handlePlaybackModeIndicatorPacket) \
+  PACKET(RecordIndicator,       RECORD_INDICATOR, &SonyRemote::handleRecordIndicatorPacket) \
+  PACKET(BatteryIndicator,      BATTERY_LEVEL,    &SonyRemote::handleBatteryIndicatorPacket) \
+  PACKET(EQIndicator,           EQ_INDICATOR,     &SonyRemote::handleEQIndicatorPacket) \
+  PACKET(AlarmIndicator,        ALARM_INDICATOR,  &SonyRemote::handleAlarmIndicatorPacket) \
+  PACKET(TrackNumber,           TRACK_NUMBER,     &SonyRemote::handleTrackNumberPacket) \
+  PACKET(DisplayText,           LCD_TEXT,         &SonyRemote::handleDisplayTextPacket)
+
+#define PACKET_ENTRY(Schema, eventType, parse) \
+  type == Schema::type ? PacketHandler{ Schema::length, EventType::eventType, parse } :
+
+constexpr SonyRemote::PacketHandler SonyRemote::packetEntry(uint8_t type){
+  return PLAYER_PACKETS(PACKET_ENTRY) PacketHandler{ PACKET_UNKNOWN, EventType::NONE, NULL };
+}
+
+#define PACKET_ENTRIES_4(t) packetEntry(t), packetEntry(t + 1), packetEntry(t + 2), packetEntry(t + 3)
+#define PACKET_ENTRIES_16(t) PACKET_ENTRIES_4(t), PACKET_ENTRIES_4(t + 4), PACKET_ENTRIES_4(t + 8), PACKET_ENTRIES_4(t + 12)
+#define PACKET_ENTRIES_64(t) PACKET_ENTRIES_16(t), PACKET_ENTRIES_16(t + 16), PACKET_ENTRIES_16(t + 32), PACKET_ENTRIES_16(t + 48)
+
+// Constant-initialized, so it ends up in flash
+const SonyRemote::PacketHandler SonyRemote::packetTable[256] = {
+  PACKET_ENTRIES_64(0x00), PACKET_ENTRIES_64(0x40), PACKET_ENTRIES_64(0x80), PACKET_ENTRIES_64(0xc0)
+};
 
-uint8_t SonyRemote::handleRequestRemoteCapabilitiesPacket(uint8_t &sum, RemoteEvent *event){
-  uint8_t block = readDataByte(sum);
+uint8_t SonyRemote::handleRequestRemoteCapabilitiesPacket(FrameReader &frame, RemoteEvent *event){
+  PacketReader<RequestCapabilities> packet = frame.read<RequestCapabilities>();
   event->type = EventType::NONE;
-  prepareRemoteCapabilities(block);
-  return 1;
+  prepareRemoteCapabilities(packet.get<Block>());
+  return RequestCapabilities::length;
 }
 
-uint8_t SonyRemote::handleTrackNumberPacket(uint8_t &sum, RemoteEvent *event){
-  uint8_t indicatorShown = readDataByte(sum);
-  uint8_t unk2 = readDataByte(sum);
-  uint8_t unk3 = readDataByte(sum);
-  uint8_t trk = readDataByte(sum);
+uint8_t SonyRemote::handleTrackNumberPacket(FrameReader &frame, RemoteEvent *event){
+  PacketReader<TrackNumber> packet = frame.read<TrackNumber>();
   event->type = EventType::TRACK_NUMBER;
-  event->data.trackNumber.number = trk;
-  event->data.trackNumber.indicatorShown = indicatorShown;
-  return 4;
+  event->data.trackNumber.number = packet.get<Number>();
+  event->data.trackNumber.indicatorShown = packet.get<IndicatorShown>();
+  return TrackNumber::length;
 }
 
-uint8_t SonyRemote::handleDisplayTextPacket(uint8_t &sum, RemoteEvent *event){
-  uint8_t segmentType = readDataByte(sum);
-  uint8_t unk = readDataByte(sum);
-  uint8_t chars[7];
-  // Not using a loop to save time.
-  chars[0] = readDataByte(sum);
-  chars[1] = readDataByte(sum);
-  chars[2] = readDataByte(sum);
-  chars[3] = readDataByte(sum);
-  chars[4] = readDataByte(sum);
-  chars[5] = readDataByte(sum);
-  chars[6] = readDataByte(sum);
-  
-  for(uint8_t potential : chars){
+uint8_t SonyRemote::handleDisplayTextPacket(FrameReader &frame, RemoteEvent *event){
+  PacketReader<DisplayText> packet = frame.read<DisplayText>();
+  for(uint8_t i = 0; i<Chars::length; i++){
+    uint8_t potential = packet.get<Chars>(i);
     if(potential == 0xff){
       break;
     }
+    if(lcdOffset >= LCD_BUFFER_LENGTH - 1){
+      // A long title, or a final segment that never came - keep what fits, the next final segment ends it
+      ++telemetry.lcdTruncations;
+      break;
+    }
     lcdBuffer[lcdOffset++] = potential; //toPrintable(potential);
   }
-  if(segmentType == 0x01){ //Final segment
+  if(packet.get<SegmentType>() == 0x01){ //Final segment
     lcdBuffer[lcdOffset] = 0;
 
     uint8_t lcdType = *lcdBuffer;
@@ -65,108 +94,117 @@ uint8_t SonyRemote::handleDisplayTextPacket(uint8_t &sum, RemoteEvent *event){
         event->data.lcd.type = EventLCDText::LCDDataType::UNKNOWN;
     }
 
-    SerialUSB.println("LCD DATA: ");
-    for(uint8_t i = 0; i<lcdOffset; i++){
-      if(lcdBuffer[i] < 0x20){
-        SerialUSB.print("[");
-        if(lcdBuffer[i] <= 0xf) SerialUSB.print("0");
-        SerialUSB.print(lcdBuffer[i], HEX);
-        SerialUSB.print("]");
-      }else SerialUSB.print(lcdBuffer[i]);
-    }
-    SerialUSB.print("\nTYPE: ");
-    SerialUSB.println(static_cast<int>(event->data.lcd.type));
+    binlog::logText(LogId::LCD_TEXT, static_cast<uint16_t>(event->data.lcd.type), lcdBuffer, lcdOffset);
     lcdOffset = 0;
     event->type = EventType::LCD_TEXT;
     event->data.lcd.text = lcdBuffer + 1; // Skip type
   }else{
     event->type = EventType::NONE;
   }
-  return 9;
+  return DisplayText::length;
 }
 
-
-uint8_t SonyRemote::handleRecordIndicatorPacket(uint8_t &sum, RemoteEvent *event){
+uint8_t SonyRemote::handleRecordIndicatorPacket(FrameReader &frame, RemoteEvent *event){
+  PacketReader<RecordIndicator> packet = frame.read<RecordIndicator>();
   event->type = EventType::RECORD_INDICATOR;
-  event->data.record.enabled = readDataByte(sum) == 0x7f;
-  return 1;
+  event->data.record.enabled = packet.get<Enabled>() == 0x7f;
+  return RecordIndicator::length;
 }
 
-uint8_t SonyRemote::handleAlarmIndicatorPacket(uint8_t &sum, RemoteEvent *event){
+uint8_t SonyRemote::handleAlarmIndicatorPacket(FrameReader &frame, RemoteEvent *event){
+  PacketReader<AlarmIndicator> packet = frame.read<AlarmIndicator>();
   event->type = EventType::ALARM_INDICATOR;
-  event->data.alarm.enabled = readDataByte(sum) == 0x7f;
-  return 1;
+  event->data.alarm.enabled = packet.get<Enabled>() == 0x7f;
+  return AlarmIndicator::length;
 }
 
-uint8_t SonyRemote::handleVolumeIndicatorPacket(uint8_t &sum, RemoteEvent *event){
-  uint8_t level = readDataByte(sum);
+uint8_t SonyRemote::handleVolumeIndicatorPacket(FrameReader &frame, RemoteEvent *event){
+  uint8_t level = frame.read<VolumeIndicator>().get<Level>();
   event->type = EventType::VOLUME_LEVEL;
   event->data.volume.level = level == 0xff ? 30 : level;
-  return 1;
+  return VolumeIndicator::length;
 }
 
-uint8_t SonyRemote::handlePlaybackModeIndicatorPacket(uint8_t &sum, RemoteEvent *event){
+uint8_t SonyRemote::handlePlaybackModeIndicatorPacket(FrameReader &frame, RemoteEvent *event){
+  PacketReader<PlaybackModeIndicator> packet = frame.read<PlaybackModeIndicator>();
   event->type = EventType::PLAYBACK_MODE;
-  event->data.playbackMode.mode = static_cast<EventPlaybackModeIndicator::PlaybackMode>(readDataByte(sum));
-  return 1;
+  event->data.playbackMode.mode = static_cast<EventPlaybackModeIndicator::PlaybackMode>(packet.get<Mode>());
+  return PlaybackModeIndicator::length;
 }
 
-uint8_t SonyRemote::handleEQIndicatorPacket(uint8_t &sum, RemoteEvent *event){
-  event->type = EventType::PLAYBACK_MODE;
-  event->data.eq.eq = static_cast<EventEQIndicator::EQ>(readDataByte(sum));
-  return 1;
+uint8_t SonyRemote::handleEQIndicatorPacket(FrameReader &frame, RemoteEvent *event){
+  PacketReader<EQIndicator> packet = frame.read<EQIndicator>();
+  event->type = EventType::EQ_INDICATOR;
+  event->data.eq.eq = static_cast<EventEQIndicator::EQ>(packet.get<Mode>());
+  return EQIndicator::length;
 }
 
-uint8_t SonyRemote::handleBatteryIndicatorPacket(uint8_t &sum, RemoteEvent *event){
+uint8_t SonyRemote::handleBatteryIndicatorPacket(FrameReader &frame, RemoteEvent *event){
+  PacketReader<BatteryIndicator> packet = frame.read<BatteryIndicator>();
   event->type = EventType::BATTERY_LEVEL;
-  event->data.battery.level = static_cast<EventBatteryIndicator::Level>(readDataByte(sum));
-  return 1;
+  event->data.battery.level = static_cast<EventBatteryIndicator::Level>(packet.get<Level>());
+  return BatteryIndicator::length;
 }
 
-uint8_t SonyRemote::handleClearLCDRegisters(uint8_t &sum, RemoteEvent *event){
+uint8_t SonyRemote::handleClearLCDRegisters(FrameReader &frame, RemoteEvent *event){
   event->type = EventType::NONE;
   //lcdOffset = 0;
-  return 0;
+  return ClearLCDRegisters::length;
+}
+
+/*
+  What the remote can show, one frame per CapabilityProfile. Only KANJI (the frame this
+  remote always sent) was checked against a player - the others go back to what the
+  0x09 / 0x10 it replaced came from, or drop the kanji charset.
+*/
+typedef ConstantFrame<Capabilities, // c0 01 09 00 00 10 0c 80 00 10, checksum 44
+  PacketValue<Block, 0x01>,
+  PacketValue<LineChars, 0x09>,
+  PacketValue<Unknown5, 0x10>,
+  PacketValue<Height, 0x0c>,
+  PacketValue<Width, 0x80>,
+  PacketValue<Unknown9, 0x10>
+> NarrowTextCapabilities;
+static_assert(NarrowTextCapabilities::checksum() == 0x44, "Capabilities frame changed");
+
+typedef ConstantFrame<Capabilities, // c0 01 ff 00 00 20 0c 80 00 10, checksum 82
+  PacketValue<Block, 0x01>,
+  PacketValue<LineChars, 0xff>,
+  PacketValue<Unknown5, 0x20>,
+  PacketValue<Height, 0x0c>,
+  PacketValue<Width, 0x80>,
+  PacketValue<Unknown9, 0x10>
+> FullWidthCapabilities;
+static_assert(FullWidthCapabilities::checksum() == 0x82, "Capabilities frame changed");
+
+typedef ConstantFrame<Capabilities, // c0 01 ff 00 00 20 0c 80 20 10, checksum a2
+  PacketValue<Block, 0x01>,
+  PacketValue<LineChars, 0xff>, // Was 0x09
+  PacketValue<Unknown5, 0x20>,  // Was 0x10
+  PacketValue<Height, 0x0c>,    // 12px tall
+  PacketValue<Width, 0x80>,     // 128px wide
+  PacketValue<Charset, 0x20>,
+  PacketValue<Unknown9, 0x10>
+> KanjiCapabilities;
+static_assert(KanjiCapabilities::checksum() == 0xa2, "Capabilities frame changed");
+
+// In CapabilityProfile order
+static const uint8_t *const capabilityFrames[CAPABILITY_PROFILES] = {
+  NarrowTextCapabilities::bytes, FullWidthCapabilities::bytes, KanjiCapabilities::bytes
+};
+
+void SonyRemote::setCapabilityProfile(CapabilityProfile profile){ capabilityProfile = profile; }
+
+const uint8_t *SonyRemote::getCapabilityFrame(CapabilityProfile profile){
+  return capabilityFrames[static_cast<uint8_t>(profile)];
 }
 
 void SonyRemote::prepareRemoteCapabilities(uint8_t block){
   if(block != 0x01){
-    D("Error unknown capabilitiy parameter: ");
-    D(block);
-    DN;
+    binlog::log(LogId::UNKNOWN_CAPABILITY, block);
     return;
   }
-  
-  uint8_t sum = 0xc0; //Packet CAPABILITIES
-  addByteToSend(0xc0); //Remote
-  
-  sum ^= 0x01; //block
-  addByteToSend(0x01);
-
-  sum ^= 0xff; //0x09; //chars on screen
-  addByteToSend(0xff);
-
-  sum ^= 0x00; //unk
-  addByteToSend(0x00);
-
-  sum ^= 0x00; //unk
-  addByteToSend(0x00);
-
-  sum ^= 0x20;//0x10; //unk
-  addByteToSend(0x20);
-
-  sum ^= 0x0C; //12px tall
-  addByteToSend(0x0C);
-
-  sum ^= 0x80; //128px wide
-  addByteToSend(0x80);
-
-  sum ^= 0x20; //charset kanji?
-  addByteToSend(0x20);
-
-  sum ^= 0x10; //unk
-  addByteToSend(0x10);
-
-  addByteToSend(sum);
+  const uint8_t *frame = getCapabilityFrame(capabilityProfile);
+  for(uint8_t i = 0; i<11; i++) addByteToSend(frame[i]);
+  finaliseOutboundMessage(OutboundPriority::RESPONSE);
 }
-
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "packetschema.h"
+
+// Layouts of the packets in remotepackets.cpp. Unknown bytes are padding until someone works them out.
+namespace packets{
+  struct Block : PacketField<1>{};
+  struct IndicatorShown : PacketField<1>{};
+  struct Number : PacketField<1>{};
+  struct SegmentType : PacketField<1>{}; // 0x01 - final segment
+  struct Chars : PacketField<7>{};       // 0xff - end of text
+  struct Enabled : PacketField<1>{};     // 0x7f - on
+  struct Level : PacketField<1>{};
+  struct Mode : PacketField<1>{};
+
+  // Player -> remote
+  typedef PacketSchema<0x01, Block> RequestCapabilities;
+  typedef PacketSchema<0x08> ClearLCDRegisters;
+  typedef PacketSchema<0x40, Level> VolumeIndicator;
+  typedef PacketSchema<0x41, Mode> PlaybackModeIndicator;
+  typedef PacketSchema<0x42, Enabled> RecordIndicator;
+  typedef PacketSchema<0x43, Level> BatteryIndicator;
+  typedef PacketSchema<0x46, Mode> EQIndicator;
+  typedef PacketSchema<0x47, Enabled> AlarmIndicator;
+  typedef PacketSchema<0xa0, IndicatorShown, PacketPadding<2>, Number> TrackNumber;
+  typedef PacketSchema<0xc8, SegmentType, PacketPadding<1>, Chars> DisplayText;
+
+  // Remote -> player
+  struct LineChars : PacketField<1>{};
+  struct Unknown5 : PacketField<1>{};
+  struct Height : PacketField<1>{};  // px
+  struct Width : PacketField<1>{};   // px
+  struct Charset : PacketField<1>{}; // 0x20 - kanji?
+  struct Unknown9 : PacketField<1>{};
+  typedef PacketSchema<0xc0, Block, LineChars, PacketPadding<2>, Unknown5, Height, Width, Charset, Unknown9> Capabilities;
+}
@@ -1,4 +1,5 @@
 #include "sonyremote-buttons.h"
+#include "binlog.h"
 
 void SonyRemoteButtons::sendButton(Button button){
   uint16_t res = static_cast<uint16_t>(button);
@@ -16,10 +17,7 @@ void SonyRemoteButtons::begin(){ disable(); }
 
 void SonyRemoteButtons::tick(){
   if(!isDepressed() && queueOffset){
-    SerialUSB.print("Q: ");
-    SerialUSB.print(queueOffset);
-    SerialUSB.print(" ");
-    SerialUSB.println(static_cast<int>(queue[0]));
+    binlog::log(LogId::BUTTON_DEQUEUE, queueOffset, static_cast<uint32_t>(queue[0]));
     sendButton(queue[0]);
     for(uint8_t i = 1; i < queueOffset; i++){
       queue[i - 1] = queue[i];
@@ -1,12 +1,9 @@
 #include "sonyremote.h"
+#include "binlog.h"
 
 SonyRemote::SonyRemote(){}
 SonyRemote::~SonyRemote(){}
 
-inline bool inRange(ul mn, ul mx, ul v){ 
-  return v > mn && v < mx; 
-}
-
 void SonyRemote::addByteToSend(uint8_t b){
   addBitToSend(b & 0b00000001);
   addBitToSend(b & 0b00000010);
@@ -18,263 +15,130 @@ void SonyRemote::addByteToSend(uint8_t b){
   addBitToSend(b & 0b10000000);
 }
 
-uint8_t SonyRemote::readDataByte(uint8_t &checksum){
-  uint8_t b = 0;
-  b |= (readDataBit());
-  b |= (readDataBit() << 1);
-  b |= (readDataBit() << 2);
-  b |= (readDataBit() << 3);
-  b |= (readDataBit() << 4);
-  b |= (readDataBit() << 5);
-  b |= (readDataBit() << 6);
-  b |= (readDataBit() << 7);
-  checksum ^= b;
-  return b;
-}
-
 /*******************************MESSAGE PARSING*******************************/
 
-inline void SonyRemote::handlePlayerMessage(){
-  eventsLeft = 0;
-  uint8_t bytesRead = 0;
+bool SonyRemote::isChecksumValid(const uint8_t *message){
   uint8_t sum = 0;
-  while(bytesRead < 10){
-    uint8_t type = readDataByte(sum);
-    ++bytesRead;
+  for(uint8_t i = 0; i<11; i++) sum ^= message[i];
+  return sum == 0; // x ^ x = 0, if sum == 0, there are no checksum errors.
+}
+
+void SonyRemote::handlePlayerMessage(const uint8_t *message, ul time){
+  releaseEvents();
+  uint8_t firstEvent = eventsQueued;
+  uint16_t firstData = eventDataUsed;
+  checksumError = !isChecksumValid(message);
+  ++telemetry.messagesReceived;
+  if(checksumError) ++telemetry.checksumFailures;
+  FrameReader frame = { message, 0 };
+  RemoteEvent event;
+  while(frame.cursor < 10){
+    uint8_t type = frame.next();
     if(type == 0){
       break; //No more data to read from this message
     }
-    uint8_t bytesReadFromPacket = handlePlayerPacket(type, sum, &events[eventsLeft++]);
-    if(events[eventsLeft - 1].type == EventType::NONE) eventsLeft--; // overwrite the 'NONE' event
+    event.type = EventType::NONE; // Unknown types return before any handler sets it
+    event.time = time;
+    uint8_t bytesReadFromPacket = handlePlayerPacket(type, frame, &event);
+    if(event.type != EventType::NONE) queueEvent(event);
     if(bytesReadFromPacket == 255 /* unknown */){
-      D("Error - unknown packet ");
-      D(type);
-      D(". Because of this ");
-      D(9 - bytesRead);
-      D(" bytes have been dropped.\n");
+      ++telemetry.unknownPackets;
+      binlog::log(LogId::UNKNOWN_PACKET, type, 10 - frame.cursor);
       break;
     }
-    bytesRead += bytesReadFromPacket;
-  }
-  while(bytesRead < 10){ // Read the rest in case the message wasn't full
-    ++bytesRead;
-    readDataByte(sum);
   }
-  readDataByte(sum);
-  checksumError = sum; // x ^ x = 0, if sum == 0, there are no checksum errors.
-}
-
-// Individual packet handling code in 'remotepackets.cpp'
-inline uint8_t SonyRemote::handlePlayerPacket(uint8_t type, uint8_t &sum, RemoteEvent *event){
-  switch(type){
-    case 0x01:
-      return handleRequestRemoteCapabilitiesPacket(sum, event);
-    case 0xa0:
-      return handleTrackNumberPacket(sum, event);
-    case 0xc8:
-      return handleDisplayTextPacket(sum, event);
-    case 0x42:
-      return handleRecordIndicatorPacket(sum, event);
-    case 0x47:
-      return handleAlarmIndicatorPacket(sum, event);
-    case 0x40:
-      return handleVolumeIndicatorPacket(sum, event);
-    case 0x41:
-      return handlePlaybackModeIndicatorPacket(sum, event);
-    case 0x46:
-      return handleEQIndicatorPacket(sum, event);
-    case 0x43:
-      return handleBatteryIndicatorPacket(sum, event);
-    case 0x08:
-      return handleClearLCDRegisters(sum, event);
-    default:
-      return 255;
+  if(checksumError){
+    // The packets still went through the handlers (LCD text is assembled across messages),
+    // but nothing of this message reaches the application.
+    eventsQueued = firstEvent;
+    eventDataUsed = firstData;
   }
 }
 
-bool SonyRemote::hasChecksumError(){ return checksumError; }
-RemoteEvent* SonyRemote::nextEvent(){
-  noInterrupts();
-  RemoteEvent *evt;
-  if(eventsLeft > 0) evt = &events[eventsLeft-- -1];
-  else evt = NULL;
-  interrupts();
-  return evt;
+// Only seen when sniffing - the frame is passed on raw, nothing here understands the remote's packets yet.
+void SonyRemote::handleRemoteMessage(const uint8_t *message, uint8_t header, ul time){
+  releaseEvents();
+  checksumError = false; // Reported in the event - the player's messages weren't affected
+  if(!(subscriptions & EVENT_MASK(EventType::REMOTE_MESSAGE))) return;
+  RemoteEvent event;
+  event.type = EventType::REMOTE_MESSAGE;
+  event.time = time;
+  event.data.remoteMessage.header = header;
+  event.data.remoteMessage.checksumValid = isChecksumValid(message);
+  event.data.remoteMessage.data = message;
+  queueEvent(event);
 }
 
+/*******************************EVENT QUEUE*******************************/
 
-void SonyRemote::finaliseOutboundMessage(){}
-
-SynchronousSonyRemote::SynchronousSonyRemote(int readPin, int writePin) : 
-  readPin(readPin), 
-  writePin(writePin){}
-SynchronousSonyRemote::~SynchronousSonyRemote(){}
-/**************************LOW LEVEL HELPER FUNCTIONS*************************/
-
-inline void SynchronousSonyRemote::pin(bool value){
-  digitalWrite(writePin, value);
-}
-
-inline bool SynchronousSonyRemote::isPin(){
-  return digitalRead(readPin);
-}
-
-inline void SynchronousSonyRemote::waitFor(bool state){
-  while(isPin() != state);
-}
-
-inline void SynchronousSonyRemote::pullFor(ul duration, bool state){
-  bool current = isPin();
-  pin(state);
-  delayus(duration);
-  pin(current);
-}
-
-inline ul SynchronousSonyRemote::getLengthOfPulse(bool state){
-  waitFor(state);
-  ul then = micros();
-  waitFor(!state);
-  ul now = micros();
-  return now - then;
-}
-
-void SynchronousSonyRemote::sendDataBit(bool data){
-  waitFor(HIGH);
-  pin(data);
-  delayus(DATA_DURATION);
-  pin(LOW);
+// Events are only made and read from the main loop, so there's no locking. The queue
+// and its data are linear and start over once everything was read - drainEvents()
+// can always return one contiguous span.
+void SonyRemote::releaseEvents(){
+  if(eventsRead < eventsQueued) return;
+  eventsQueued = eventsRead = 0;
+  eventDataUsed = 0;
 }
 
-inline bool SynchronousSonyRemote::readDataBit(){
-  waitFor(LOW);
-  ul duration = getLengthOfPulse(LOW);
-  return !inRange(DATABIT_LOW_RANGE, duration);
+const void *SonyRemote::storeEventData(const void *data, uint8_t length){
+  if(eventDataUsed + length > EVENT_DATA_LENGTH) return NULL;
+  void *stored = eventData + eventDataUsed;
+  memcpy(stored, data, length);
+  eventDataUsed += length;
+  return stored;
 }
 
-void SynchronousSonyRemote::handleMessage(ul presyncOffset){
-  ul presyncDuration = presyncOffset + getLengthOfPulse(LOW);
-  eventsLeft = 0;
-  checksumError = false;
-  #ifdef PRECISE_PRESYNC
-  if(!inRange(PRESYNC_RANGE, presyncDuration)){
-  #endif
-    if(inRange(PRESYNC_RESET_RANGE, presyncDuration)){
-      resetCommunications();
-    }
-    #ifdef PRECISE_PRESYNC
-    else{
-      D("Not in presync range: ");
-      D(presyncDuration);
-      DN;
-      event->type = EventType::TIMING_ERROR;
-      return;
-    }
-  }
-  #endif
-  // Now wait for the presync delay to pass
-  waitFor(LOW);
-
-  // Now in SYNC pulse
-  ul syncDuration = getLengthOfPulse(LOW);
-  if(!inRange(SYNC_RANGE, syncDuration)){
-    // Nope - something's wrong;
-    D("Not in sync range: ");
-    D(syncDuration);
-    DN;
+// The text / frame the event points to only lives until the next message, it's copied.
+void SonyRemote::queueEvent(const RemoteEvent &event){
+  if(eventsQueued == EVENT_QUEUE_LENGTH){
+    ++telemetry.eventOverflows;
     return;
   }
-  // Is now HIGH
-
-  // Now in the remote header - we need to send data to inform the player 
-  // about the remote's state
-  handleRemoteHeader();
-
-  // Now in player header - read...
-
-  waitFor(HIGH);
-
-  bool hasData = !readDataBit();
-  bool unk1 = readDataBit();
-  bool unk2 = readDataBit();
-  bool unk3 = readDataBit();
-  bool cedeBus = readDataBit();
-  bool unk4 = readDataBit();
-  bool unk5 = readDataBit();
-  bool playerPresent = readDataBit(); //It's not like we're getting this data from the player...
-
-  if(!isInitialized){
-    initialize();
-    D("INIT!\n");
-  }else if(!cedeBus && hasData){
-    //Player's talking
-    handlePlayerMessage(); 
-  }else if(bitsToSend > 0 && cedeBus){
-    continuePreviousMessage();
+  RemoteEvent &queued = events[eventsQueued];
+  queued = event;
+  bool stored = true;
+  if(event.type == EventType::LCD_TEXT){
+    queued.data.lcd.text = (char *) storeEventData(event.data.lcd.text, strlen(event.data.lcd.text) + 1);
+    stored = queued.data.lcd.text;
+  }else if(event.type == EventType::REMOTE_MESSAGE){
+    queued.data.remoteMessage.data = (const uint8_t *) storeEventData(event.data.remoteMessage.data, 11);
+    stored = queued.data.remoteMessage.data;
   }
+  if(stored) ++eventsQueued;
+  else ++telemetry.eventOverflows;
 }
 
-void SynchronousSonyRemote::addBitToSend(bool b){
-  outboundBuffer[bitsToSend >> 3] |= (b << (bitsToSend & 0b111));
-  ++bitsToSend;
-}
-
-inline void SynchronousSonyRemote::handleRemoteHeader(){
-  // Nothing yet...
-  // 0 <readyForText> 0 0 <hasDataToSend> 0 <fullWidthSupported> <initialized>
-  sendDataBit(LOW);
-  sendDataBit(isReadyForText);
-  sendDataBit(LOW);
-  sendDataBit(LOW);
-  sendDataBit(bitsToSend > 0);
-  sendDataBit(LOW);
-  sendDataBit(LOW);
-  sendDataBit(isInitialized);
-}
-
-inline void SynchronousSonyRemote::continuePreviousMessage(){
-  uint8_t bytesToSend = bitsToSend >> 3;
-  for(uint8_t i = 0; i<bytesToSend; i++){
-    readDataBit();
-    sendDataByte(outboundBuffer[i]);
-  }
-  bitsToSend &= 0b111;
-  if(bitsToSend){
-    readDataBit();
-    uint8_t i = 0;
-    while(bitsToSend--){
-      sendDataBit(outboundBuffer[bytesToSend] & (1 << i++));
-    }
+// Individual packet handling code in 'remotepackets.cpp'
+inline uint8_t SonyRemote::handlePlayerPacket(uint8_t type, FrameReader &frame, RemoteEvent *event){
+  const PacketHandler &packet = packetTable[type];
+  if(packet.length == PACKET_UNKNOWN) return 255;
+  if(!packet.parse || (packet.event != EventType::NONE && !(subscriptions & EVENT_MASK(packet.event)))){
+    return skipPacket(frame, event, packet.length);
   }
+  return (this->*packet.parse)(frame, event);
 }
 
-void SynchronousSonyRemote::sendDataByte(uint8_t b){
-  sendDataBit(b & 0b00000001);
-  sendDataBit(b & 0b00000010);
-  sendDataBit(b & 0b00000100);
-  sendDataBit(b & 0b00001000);
-  sendDataBit(b & 0b00010000);
-  sendDataBit(b & 0b00100000);
-  sendDataBit(b & 0b01000000);
-  sendDataBit(b & 0b10000000);
+inline uint8_t SonyRemote::skipPacket(FrameReader &frame, RemoteEvent *event, uint8_t length){
+  event->type = EventType::NONE;
+  frame.skip(length);
+  return length;
 }
 
-
-inline void SynchronousSonyRemote::resetCommunications(){
-  // Reset all the variables related to split messages.
-  isReadyForText = false;
-  bitsToSend = 0;
-  isInitialized = false;
-  D("Reset!\n");
+bool SonyRemote::hasChecksumError(){ return checksumError; }
+void SonyRemote::setSubscriptions(uint16_t eventMask){ subscriptions = eventMask; }
+void SonyRemote::getTelemetry(BusTelemetry &snapshot){ snapshot = telemetry; }
+RemoteEvent* SonyRemote::nextEvent(){
+  return eventsRead < eventsQueued ? &events[eventsRead++] : NULL;
 }
 
-inline void SynchronousSonyRemote::initialize(){
-  isInitialized = true;
-  isReadyForText = true;
+EventSpan SonyRemote::drainEvents(){
+  EventSpan span = { events + eventsRead, (uint8_t) (eventsQueued - eventsRead) };
+  eventsRead = eventsQueued;
+  return span;
 }
 
-void SynchronousSonyRemote::waitForMessage(){
-  waitFor(LOW);
-}
+
+void SonyRemote::finaliseOutboundMessage(OutboundPriority){}
 
 #define REPR_HELPER(...)  l = snprintf(buffer, bufferLength, __VA_ARGS__);  \
                           buffer += l;                                      \
@@ -312,6 +176,12 @@ int repr(char *buffer, int bufferLength, RemoteEvent *evt){
     case EventType::PLAYBACK_MODE:
       REPR_HELPER("Pb: %d", evt->data.playbackMode.mode);
       break;
+    case EventType::REMOTE_MESSAGE:
+      REPR_HELPER("Remote [%02x]%s:", evt->data.remoteMessage.header, evt->data.remoteMessage.checksumValid ? "" : " (bad checksum)");
+      for(uint8_t i = 0; i<11; i++){
+        REPR_HELPER(" %02x", evt->data.remoteMessage.data[i]);
+      }
+      break;
     case EventType::NOT_IMPLEMENTED:
       REPR_HELPER("NIMPL");
       break;
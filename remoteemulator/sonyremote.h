@@ -1,21 +1,38 @@
 #pragma once
 
 //#define REMOTE_DEBUG
-//#define PRECISE_PRESYNC
+//#define ASYNC_DEFERRED_DECODING /*ISR only timestamps edges, AsyncSonyRemote::handleMessage() decodes them. Listen-only.*/
 
 #include <stdint.h>
 #include <Arduino.h>
+#include "pulsetimer.h"
+#include "timebase.h"
+#include "fastpin.h"
+#include "bitclassifier.h"
+#include "spscqueue.h"
+#include "packetschema.h"
 
 /*************************TIMINGS********************/
 #define DATA_DURATION 210 /*us*/
 #define PRESYNC_RESET_RANGE 39000, 45000 /*Was 41000*/
 #define PRESYNC_RANGE 900, 1600 /*Was 1120*/
 #define SYNC_RANGE 190, 250 /*Was 220*/
-#define DATABIT_LOW_RANGE 100, 250
+#define DATABIT_LOW_RANGE 100, 250 /*Starting point - the upper bound adapts, see bitclassifier.h*/
+#define DATABIT_THRESHOLD_RANGE 200, 400 /*Limits for the adaptive upper bound. Past 250 on purpose: a slower player's 0s are ~260us. 400 is the nominal 1, so the threshold can't move past the 1s.*/
 
   
 #define delayus delayMicroseconds
 #define MAX_PACKETS_PER_MESSAGE 10 /*Packets are 11 bytes, 1 for checksum. There can be max. 10 1 byte packets.*/
+#define EVENT_QUEUE_LENGTH 32 /*Events waiting to be read - a few messages' worth*/
+#define EVENT_DATA_LENGTH 256 /*Bytes - LCD text and remote frames of the queued events*/
+#define LCD_BUFFER_LENGTH 64 /*One complete LCD text, type byte and terminator included*/
+#define PACKET_UNKNOWN 255 /*Packet length of types missing from PLAYER_PACKETS (remotepackets.cpp)*/
+#define EDGE_QUEUE_LENGTH 256 /*Power of two. A full message is ~220 edges.*/
+#ifndef MESSAGE_QUEUE_LENGTH
+#define MESSAGE_QUEUE_LENGTH 16 /*Power of two. Complete 11 byte messages waiting for handleMessage().*/
+#endif
+#define OUTBOUND_QUEUE_LENGTH 4 /*Power of two. Messages waiting for a cede, per OutboundPriority.*/
+#define RESPONSE_MAX_AGE 1000000 /*us - the player asks again if a capability answer doesn't come*/
 
 #ifdef REMOTE_DEBUG
 #define D(x...) SerialUSB.print(x)
@@ -27,6 +44,10 @@
 
 typedef unsigned long int ul;
 
+inline bool inRange(ul mn, ul mx, ul v){ 
+  return v > mn && v < mx; 
+}
+
 enum class EventType{
   NONE,
   LCD_TEXT, 
@@ -37,8 +58,11 @@ enum class EventType{
   RECORD_INDICATOR,
   EQ_INDICATOR,
   PLAYBACK_MODE,
+  REMOTE_MESSAGE,
   NOT_IMPLEMENTED
 };
+#define EVENT_TYPES 11
+#define EVENT_MASK(type) (1 << static_cast<int>(type))
 
 struct EventTrackNumber{
   uint8_t number;
@@ -100,8 +124,16 @@ struct EventEQIndicator{
   } eq;
 };
 
+// A message a real remote sent to the player - passive mode only.
+struct EventRemoteMessage{
+  uint8_t header;      // The remote's header bits of that frame
+  bool checksumValid;
+  const uint8_t *data; // 10 bytes + checksum, valid as long as the event
+};
+
 struct RemoteEvent{
   EventType type;
+  ul time; // Start of the bus message (presync), timebase::now() clock
   union{
     EventTrackNumber trackNumber;
     EventLCDText lcd;
@@ -111,97 +143,328 @@ struct RemoteEvent{
     EventPlaybackModeIndicator playbackMode;
     EventEQIndicator eq;
     EventBatteryIndicator battery;
+    EventRemoteMessage remoteMessage;
   } data;
 };
 
+// Pending events in bus order - see SonyRemote::drainEvents().
+struct EventSpan{
+  RemoteEvent *events;
+  uint8_t count;
+
+  RemoteEvent *begin() const { return events; }
+  RemoteEvent *end() const { return events + count; }
+};
+
+enum class TransmitState{
+  AWAITING_MESSAGE, BEFORE_SYNC, IN_PLAYER_HEADER, IN_REMOTE_HEADER, PLAYER_SENDING, REMOTE_SENDING
+};
+#define TRANSMIT_STATES 6
+
+enum class BusDirection : uint8_t{
+  PLAYER, REMOTE
+};
+
+// Why the async decoder went back to AWAITING_MESSAGE
+enum class ResetReason{
+  PRESYNC, SYNC, REMOTE_SENT, MESSAGE_RECEIVED, TIMEOUT
+};
+#define RESET_REASONS 5
+
+// Remote -> player messages are sent highest priority first. A message that has started keeps the bus.
+enum class OutboundPriority : uint8_t{
+  BACKGROUND, NORMAL, RESPONSE
+};
+#define OUTBOUND_PRIORITIES 3
+
+// What the remote tells the player it can show (remotepackets.cpp)
+enum class CapabilityProfile : uint8_t{
+  NARROW_TEXT, // 9 characters a line, no kanji - asks for the least text
+  FULL_WIDTH,  // 128px, no kanji
+  KANJI        // 128px with the kanji charset - the frame this remote always sent
+};
+#define CAPABILITY_PROFILES 3
+
+struct PulseStatistics{
+  ul min;
+  ul max;
+  uint64_t total;
+  uint32_t count;
+
+  ul getMean() const { return count ? total / count : 0; }
+};
+
+// Bus health counters - see SonyRemote::getTelemetry()
+struct BusTelemetry{
+  uint32_t messagesReceived;
+  uint32_t checksumFailures;
+  uint32_t unknownPackets;
+  uint32_t lcdTruncations; // LCD text segments cut off at LCD_BUFFER_LENGTH
+  uint32_t queueOverflows;
+  uint32_t eventOverflows; // Events dropped because nobody read the event queue
+  uint32_t outboundQueued;
+  uint32_t outboundRejected; // Outbound queue of that priority was full
+  uint32_t outboundSent;
+  uint32_t outboundExpired;  // Still waiting when their maxAge ran out
+  uint32_t resets[RESET_REASONS];
+  PulseStatistics pulses[TRANSMIT_STATES]; // Low pulse widths, by the state they ended in
+};
+
+// Cursor over a fully received 11 byte player message (10 payload bytes + checksum).
+struct FrameReader{
+  const uint8_t *frame;
+  uint8_t cursor;
+
+  inline uint8_t next(){
+    return cursor < 10 ? frame[cursor++] : 0; // Never read into the checksum
+  }
+
+  inline void skip(uint8_t length){
+    cursor = cursor + length < 10 ? cursor + length : 10;
+  }
+
+  // The packet at the cursor (see remotepackets.h), the cursor moves past it
+  template<class Schema>
+  inline PacketReader<Schema> read(){
+    PacketReader<Schema> packet(frame + cursor, 10 - cursor);
+    skip(Schema::length);
+    return packet;
+  }
+};
+
 class SonyRemote{
   public:
   SonyRemote();
   ~SonyRemote();
 
+  // Events are queued in bus order and kept across messages until they're read.
+  // An event (and the text it points to) stays valid until the next handleMessage()
+  // after the queue was emptied. Events of a message with a bad checksum are dropped.
   RemoteEvent* nextEvent();
+  // All pending events in one go, oldest first.
+  EventSpan drainEvents();
   bool hasChecksumError();
+  // EVENT_MASK()s of the events the application reads, all by default. Packets of other
+  // types are stepped over by their length without building an event - the message
+  // is still checksummed, and capability requests are always answered.
+  void setSubscriptions(uint16_t eventMask);
+  // Profile of the next capability answer, KANJI by default. The player only asks when
+  // it's connected, so a change applies from its next request.
+  void setCapabilityProfile(CapabilityProfile profile);
+  // The 11 byte answer of a profile, checksum included
+  static const uint8_t *getCapabilityFrame(CapabilityProfile profile);
+  // Consistent copy of the counters, safe to call while the bus is running.
+  virtual void getTelemetry(BusTelemetry &snapshot);
 
   protected:
   // Low-level helpers:
 
-  virtual bool readDataBit() = 0;
   virtual void addBitToSend(bool b) = 0;
-  virtual uint8_t readDataByte(uint8_t &checksum);
   virtual void addByteToSend(uint8_t byte);
-  virtual void finaliseOutboundMessage();
+  // The bits added since the last call make up one message
+  virtual void finaliseOutboundMessage(OutboundPriority priority);
 
   // Communication methods:
-  void handlePlayerMessage();
-  uint8_t handlePlayerPacket(uint8_t type, uint8_t &sum, RemoteEvent *event);
+  static bool isChecksumValid(const uint8_t *message);
+  void handlePlayerMessage(const uint8_t *message, ul time = 0);
+  void handleRemoteMessage(const uint8_t *message, uint8_t header, ul time);
+  uint8_t handlePlayerPacket(uint8_t type, FrameReader &frame, RemoteEvent *event);
+  uint8_t skipPacket(FrameReader &frame, RemoteEvent *event, uint8_t length);
+
+  // Packet dispatch - one entry per type byte, built at compile time from PLAYER_PACKETS.
+  typedef uint8_t (SonyRemote::*PacketParser)(FrameReader &frame, RemoteEvent *event);
+  struct PacketHandler{
+    uint8_t length;     // Bytes after the type byte. PACKET_UNKNOWN: the rest of the frame is dropped.
+    EventType event;    // The subscription it needs, NONE: always parsed
+    PacketParser parse; // NULL: known length, nothing parses it - skipped
+  };
+  static constexpr PacketHandler packetEntry(uint8_t type);
+  static const PacketHandler packetTable[256];
 
   // Packet handling (remotepackets.cpp)
-  uint8_t handleRequestRemoteCapabilitiesPacket(uint8_t &sum, RemoteEvent *event);
-  uint8_t handleTrackNumberPacket(uint8_t &sum, RemoteEvent *event);
-  uint8_t handleDisplayTextPacket(uint8_t &sum, RemoteEvent *event);
-  uint8_t handleRecordIndicatorPacket(uint8_t &sum, RemoteEvent *event);
-  uint8_t handleAlarmIndicatorPacket(uint8_t &sum, RemoteEvent *event);
-  uint8_t handleVolumeIndicatorPacket(uint8_t &sum, RemoteEvent *event);
-  uint8_t handlePlaybackModeIndicatorPacket(uint8_t &sum, RemoteEvent *event);
-  uint8_t handleEQIndicatorPacket(uint8_t &sum, RemoteEvent *event);
-  uint8_t handleBatteryIndicatorPacket(uint8_t &sum, RemoteEvent *event);
-  uint8_t handleClearLCDRegisters(uint8_t &sum, RemoteEvent *event);
+  uint8_t handleRequestRemoteCapabilitiesPacket(FrameReader &frame, RemoteEvent *event);
+  uint8_t handleTrackNumberPacket(FrameReader &frame, RemoteEvent *event);
+  uint8_t handleDisplayTextPacket(FrameReader &frame, RemoteEvent *event);
+  uint8_t handleRecordIndicatorPacket(FrameReader &frame, RemoteEvent *event);
+  uint8_t handleAlarmIndicatorPacket(FrameReader &frame, RemoteEvent *event);
+  uint8_t handleVolumeIndicatorPacket(FrameReader &frame, RemoteEvent *event);
+  uint8_t handlePlaybackModeIndicatorPacket(FrameReader &frame, RemoteEvent *event);
+  uint8_t handleEQIndicatorPacket(FrameReader &frame, RemoteEvent *event);
+  uint8_t handleBatteryIndicatorPacket(FrameReader &frame, RemoteEvent *event);
+  uint8_t handleClearLCDRegisters(FrameReader &frame, RemoteEvent *event);
 
   void prepareRemoteCapabilities(uint8_t block);
 
-  RemoteEvent events[MAX_PACKETS_PER_MESSAGE]; 
-  uint8_t eventsLeft = 0;
+  void releaseEvents();
+  void queueEvent(const RemoteEvent &event);
+  const void *storeEventData(const void *data, uint8_t length);
+
+  RemoteEvent events[EVENT_QUEUE_LENGTH];
+  uint8_t eventsQueued = 0;
+  uint8_t eventsRead = 0;
+  uint8_t eventData[EVENT_DATA_LENGTH]; // What the queued events point to
+  uint16_t eventDataUsed = 0;
   bool checksumError;
+  uint16_t subscriptions = 0xffff;
+  CapabilityProfile capabilityProfile = CapabilityProfile::KANJI;
+  BusTelemetry telemetry = {};
 
-  char lcdBuffer[64];
+  char lcdBuffer[LCD_BUFFER_LENGTH];
   uint8_t lcdOffset = 0;
 };
 
-class SynchronousSonyRemote : public SonyRemote{
-  public:
-  SynchronousSonyRemote(int readPin, int writePin);
-  virtual ~SynchronousSonyRemote();
-  void handleMessage(ul presyncOffset = 0);
-  void waitForMessage();
+/*
+  Edge-by-edge framing of the bus (asyncsonyremote.cpp): decodeEdge() runs the
+  presync / sync / header / data state machine, answers through pulseTimer and
+  queues complete player messages. Instances don't share anything, so host tools
+  can run one per thread over different parts of a capture.
+*/
+struct BusDecoder{
+  struct Edge{
+    ul time;
+    bool level;
+  };
+
+  struct Message{
+    uint8_t data[11];
+    BusDirection direction;
+    uint8_t header; // Remote header bits (passive) of the frame
+    ul time;        // Start of the presync
+  };
+
+  struct OutboundMessage{
+    uint8_t data[11];
+    ul queued;
+    ul maxAge; // us, 0 - never expires
+  };
+
+  BusDecoder();
+  void decodeEdge(bool level, ul time);
+  // Edge ISR: timestamps the edge, then decodes it or queues it (rawCapture / ASYNC_DEFERRED_DECODING)
+  void handleEdge(bool level);
+  // Drops the frame in progress - for callers that notice a missing edge (synchronoussonyremote.h)
+  void timeout();
+
+  // Remote -> player. NULL for listen-only decoders. The header flags are cleared for the
+  // frame that follows a PRESYNC_RESET_RANGE presync and come back with the next one.
+  PulseTimer *pulseTimer = NULL;
+  volatile bool isReadyForText = true;
+  volatile bool isInitialized = true;
+
+  // Main loop side of the outbound queues. The ISR announces the oldest message of the
+  // highest priority in every remote header and sends it when the player cedes the bus;
+  // with more waiting it asks again in the next header, so they go out on consecutive cedes.
+  bool queueOutbound(const uint8_t *frame, OutboundPriority priority, ul maxAge, ul now);
+  bool hasOutbound();
+  uint8_t getOutboundLength();
+  bool isSending(){ return state == TransmitState::REMOTE_SENDING && sending; }
+
+  // Passive: never drive the bus, decode the real remote's header and messages instead.
+  volatile bool passive = false;
+
+  // Player -> remote
+  volatile bool rawCapture = false; // The ISR only queues edges, for EdgeStreamer
+  SPSCQueue<Edge, EDGE_QUEUE_LENGTH> edgeQueue; // ASYNC_DEFERRED_DECODING or rawCapture
+  volatile uint16_t droppedEdges = 0;
+  SPSCQueue<Message, MESSAGE_QUEUE_LENGTH> messageQueue;
+  volatile uint16_t queueHighWaterMark = 0;
+  volatile uint16_t droppedMessages = 0;
+  BitClassifier bitClassifier;
+
+  // Written only by decodeEdge(), version is bumped after every update so a reader can retry.
+  BusTelemetry busTelemetry = {};
+  volatile uint32_t telemetryVersion = 0;
+
+  // Framing state for code running in the same ISR (busbridge.h)
+  TransmitState getState(){ return state; }
+  uint8_t getBitOffset(){ return messageBufferOffset; }
+  const volatile uint8_t *getMessageBuffer(){ return messageBuffer; }
+
+  private:
+  void recordPulse(TransmitState in, ul duration);
+  void resetComm(ResetReason why);
+  void writeDataBit(bool s);
+  void queueMessage(BusDirection direction);
+  bool announceOutbound(ul now);
+
+  volatile TransmitState state = TransmitState::AWAITING_MESSAGE;
+  volatile ul bitStartTime = 0;
+  volatile uint8_t messageBuffer[11];
+  volatile uint8_t messageBufferOffset = 0;
+  volatile uint8_t playerHeaderFlags = 0;
+  volatile uint8_t remoteHeaderFlags = 0;
+  volatile ul messageStart = 0;
+  bool playerReset = false; // This frame's presync was a bus reset
+
+  SPSCQueue<OutboundMessage, OUTBOUND_QUEUE_LENGTH> outbound[OUTBOUND_PRIORITIES];
+  const OutboundMessage *sending = NULL; // Announced in the remote header, ISR only
+  int8_t sendingPriority = 0;
+};
 
-  protected:
-  uint8_t bitsToSend;
-  uint8_t outboundBuffer[11];
-  int readPin, writePin;
-  void pin(bool value);
-  bool isPin();
-  void waitFor(bool state);
-  void pullFor(ul duration, bool state);
-  ul getLengthOfPulse(bool state);
-  void sendDataBit(bool data);
-  void sendDataByte(uint8_t data);
-  void continuePreviousMessage();
-  void handleRemoteHeader();
-  void resetCommunications();
-  void initialize();
-
-
-  virtual bool readDataBit();
-  virtual void addBitToSend(bool b);
+class AsyncSonyRemoteBase : public SonyRemote{
 
+  public:
+  AsyncSonyRemoteBase(PulseTimer *pulseTimer);
+  bool handleMessage();
 
-  bool hasDataToSend = false;
-  bool isReadyForText = false;
-  bool isInitialized = false;
+  uint16_t getQueueHighWaterMark();
+  uint16_t getDroppedMessages();
+  ul getBitThreshold();
+  virtual void getTelemetry(BusTelemetry &snapshot);
 
-};
+  // Passive sniffing: the pulse timer and write pin are never touched, messages from a real
+  // remote on the same bus come out as EventType::REMOTE_MESSAGE.
+  void setPassive(bool passive);
 
-class AsyncSonyRemote : public SonyRemote{
+  // Queues an 11 byte frame (checksum included) for the player. false if that priority's
+  // queue is full. maxAge (us, 0 - never) drops it if no cede came in time.
+  bool sendMessage(const uint8_t *frame, OutboundPriority priority = OutboundPriority::NORMAL, ul maxAge = 0);
+  uint8_t getPendingMessages(){ return bus.getOutboundLength(); }
 
-  public:
-  AsyncSonyRemote(int readPin, int writePin);
-  bool handleMessage();
-  void begin();
+  // Raw edge capture: the bus isn't decoded or answered, edges are only timestamped and queued.
+  void setRawCapture(bool enabled);
+  bool readRawEdge(BusDecoder::Edge &edge);
+  uint16_t getDroppedEdges();
 
   protected:
-  virtual bool readDataBit();
+  void begin(uint8_t readPin, void (*isr)());
+  void decodePendingEdges();
   virtual void addBitToSend(bool b);
-  virtual void finaliseOutboundMessage();
+  virtual void finaliseOutboundMessage(OutboundPriority priority);
+  void discardOutboundMessage();
+
+  BusDecoder bus;
+  bool pulseTimerStarted = false;
+  uint8_t outboundFrame[11] = {}; // Built bit by bit by the packet handlers
+  uint8_t writingCursor = 0;
+};
+
+/*
+  ReadPin is a FastPin type - the edge ISR reads the port register directly.
+  Every ReadPin gets its own ISR and instance pointer, so there can be one remote per
+  bus / pin. On the SAMD21 only two of them can answer (TC3 has two pulse channels),
+  any number can listen with setPassive().
+*/
+template<class ReadPin>
+class AsyncSonyRemote : public AsyncSonyRemoteBase{
+  public:
+  AsyncSonyRemote(PulseTimer *pulseTimer) : AsyncSonyRemoteBase(pulseTimer){}
+
+  void begin(){
+    ReadPin::begin();
+    instance = this;
+    AsyncSonyRemoteBase::begin(ReadPin::pin, isr);
+  }
+
+  private:
+  static void isr(){
+    instance->bus.handleEdge(ReadPin::read());
+  }
+
+  static AsyncSonyRemote *instance;
 };
 
+template<class ReadPin>
+AsyncSonyRemote<ReadPin> *AsyncSonyRemote<ReadPin>::instance = NULL;
+
 int repr(char* buffer, int bufferLength, RemoteEvent* event);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Compiler barrier - the buffer slot must be fully written / read before the index moves.
+#define SPSC_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/*
+  Single producer / single consumer ring buffer.
+  The producer (usually an ISR) only writes 'head', the consumer only writes 'tail',
+  so neither side ever needs to disable interrupts. Length must be a power of two.
+*/
+template<typename T, uint16_t Length>
+class SPSCQueue{
+  static_assert((Length & (Length - 1)) == 0, "SPSCQueue length must be a power of two");
+
+  public:
+  inline bool push(const T &item){
+    uint16_t h = head;
+    if((uint16_t)(h - tail) >= Length) return false;
+    buffer[h & (Length - 1)] = item;
+    SPSC_BARRIER();
+    head = h + 1;
+    return true;
+  }
+
+  inline bool pop(T &item){
+    uint16_t t = tail;
+    if(t == head) return false;
+    SPSC_BARRIER();
+    item = buffer[t & (Length - 1)];
+    SPSC_BARRIER();
+    tail = t + 1;
+    return true;
+  }
+
+  // Zero-copy consumer access: peek at the oldest item, release it with drop().
+  inline T* front(){
+    uint16_t t = tail;
+    if(t == head) return NULL;
+    SPSC_BARRIER();
+    return &buffer[t & (Length - 1)];
+  }
+
+  inline void drop(){
+    SPSC_BARRIER();
+    tail = tail + 1;
+  }
+
+  inline bool isEmpty(){ return head == tail; }
+  inline uint16_t size(){ return head - tail; }
+  inline void clear(){ tail = head; }
+
+  private:
+  T buffer[Length];
+  volatile uint16_t head = 0;
+  volatile uint16_t tail = 0;
+};
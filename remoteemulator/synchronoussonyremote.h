@@ -0,0 +1,98 @@
+#pragma once
+
+#include "sonyremote.h"
+#include "fastpin.h"
+#include "timebase.h"
+
+#define EDGE_TIMEOUT 2000 /*us - the longest wait for an edge inside a frame (presync is ~1.1ms)*/
+#define STUCK_LINE_TIMEOUT 100000 /*us - low for longer than any reset pulse (PRESYNC_RESET_RANGE)*/
+
+// What SynchronousSonyRemote::poll() found
+enum class PollResult : uint8_t{
+  BUSY,   // Inside a frame - poll again within ~20us
+  IDLE,   // Between frames, line high - see SynchronousSonyRemote for how long that lasts
+  TIMEOUT // An edge didn't come in time or the line is stuck low - the frame was dropped
+};
+
+// The remote's pulses, released by the next poll() after their end instead of by a timer.
+template<class WritePin>
+class PolledPulseTimer : public PulseTimer{
+  public:
+  virtual void begin(){ WritePin::write(LOW); }
+  virtual void pulse(uint16_t duration){
+    WritePin::write(HIGH);
+    releaseTime = timebase::now() + duration;
+    pulsing = true;
+  }
+  virtual bool isPulsing(){
+    if(pulsing && (long)(timebase::now() - releaseTime) >= 0){
+      WritePin::write(LOW);
+      pulsing = false;
+    }
+    return pulsing;
+  }
+
+  private:
+  ul releaseTime;
+  bool pulsing = false;
+};
+
+/*
+  Reads and drives the bus from the main loop, no interrupts or timers. ReadPin / WritePin
+  are FastPin types. Every poll() samples the line once and hands a changed level to the
+  same BusDecoder the async remote uses, so it never waits: the frame state lives in the
+  decoder and poll() picks up where the last call left off. Every wait has a deadline -
+  no edge for EDGE_TIMEOUT inside a frame drops it, and a line held low past
+  STUCK_LINE_TIMEOUT is reported once, so a stuck bus shows up as PollResult::TIMEOUT.
+
+  Pulse widths are only as exact as the polling: while BUSY the gaps between calls have
+  to stay under ~20us, or sync pulses start missing SYNC_RANGE. Frames follow each other
+  closely, so after an IDLE there are only ~400us (the gap before the presync plus what
+  PRESYNC_RANGE allows of a late presync edge). That's enough for handleMessage() and a
+  button check - longer work (a display flush) has to be split up or costs frames, which
+  show up as presync resets, not as a hang.
+*/
+template<class ReadPin, class WritePin>
+class SynchronousSonyRemote : public AsyncSonyRemoteBase{
+  public:
+  SynchronousSonyRemote() : AsyncSonyRemoteBase(&pulseTimer){}
+
+  void begin(){
+    ReadPin::begin();
+    WritePin::begin();
+    timebase::begin();
+    pulseTimer.begin();
+    pulseTimerStarted = true;
+    level = ReadPin::read();
+    lastEdge = timebase::now();
+  }
+
+  PollResult poll(){
+    pulseTimer.isPulsing(); // Ends our bit once its time is up
+    ul now = timebase::now();
+    bool current = ReadPin::read();
+    if(current != level){
+      level = current;
+      lastEdge = now;
+      stuck = false;
+      bus.decodeEdge(level, now);
+    }else if(bus.getState() != TransmitState::AWAITING_MESSAGE){
+      if(now - lastEdge > EDGE_TIMEOUT){
+        bus.timeout();
+        return PollResult::TIMEOUT;
+      }
+    }else if(level == LOW && !stuck && now - lastEdge > STUCK_LINE_TIMEOUT){
+      stuck = true;
+      return PollResult::TIMEOUT;
+    }
+    return level == HIGH && bus.getState() == TransmitState::AWAITING_MESSAGE ? PollResult::IDLE : PollResult::BUSY;
+  }
+
+  bool isLineStuck(){ return stuck; }
+
+  private:
+  PolledPulseTimer<WritePin> pulseTimer;
+  bool level = HIGH;
+  ul lastEdge = 0;
+  bool stuck = false;
+};
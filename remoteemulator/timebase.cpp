@@ -0,0 +1,40 @@
+#include "timebase.h"
+
+#ifdef ARDUINO_ARCH_SAMD
+
+#define MICROSECOND_GCLK 4 /*DFLL48M / 48*/
+
+void timebase::routeMicrosecondClock(uint16_t clockId){
+  static bool generatorReady = false;
+  if(!generatorReady){
+    GCLK->GENDIV.reg = GCLK_GENDIV_ID(MICROSECOND_GCLK) | GCLK_GENDIV_DIV(48);
+    while(GCLK->STATUS.bit.SYNCBUSY);
+    GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(MICROSECOND_GCLK) | GCLK_GENCTRL_SRC_DFLL48M | GCLK_GENCTRL_IDC | GCLK_GENCTRL_GENEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);
+    generatorReady = true;
+  }
+  GCLK->CLKCTRL.reg = clockId | GCLK_CLKCTRL_GEN(MICROSECOND_GCLK) | GCLK_CLKCTRL_CLKEN;
+  while(GCLK->STATUS.bit.SYNCBUSY);
+}
+
+void timebase::begin(){
+  if(TC4->COUNT32.CTRLA.bit.ENABLE) return;
+
+  routeMicrosecondClock(GCLK_CLKCTRL_ID_TC4_TC5);
+  PM->APBCMASK.reg |= PM_APBCMASK_TC4 | PM_APBCMASK_TC5;
+
+  TC4->COUNT32.CTRLA.reg = TC_CTRLA_SWRST;
+  while(TC4->COUNT32.CTRLA.bit.SWRST);
+  TC4->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32 | TC_CTRLA_WAVEGEN_NFRQ | TC_CTRLA_PRESCALER_DIV1;
+  while(TC4->COUNT32.STATUS.bit.SYNCBUSY);
+  // Continuous read synchronisation - now() never has to wait for a READREQ
+  TC4->COUNT32.READREQ.reg = TC_READREQ_RCONT | TC_READREQ_ADDR(TC_COUNT32_COUNT_OFFSET);
+  TC4->COUNT32.CTRLA.bit.ENABLE = 1;
+  while(TC4->COUNT32.STATUS.bit.SYNCBUSY);
+}
+
+#else
+
+void timebase::begin(){}
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+  Microsecond clock used to timestamp bus edges.
+  On SAMD21 this is TC4+TC5 chained into a free-running 32 bit counter clocked at 1MHz,
+  so reading it is a single register load instead of micros()' SysTick retry loop.
+  Everywhere else it falls back to micros() (the host build simulates that clock).
+*/
+namespace timebase{
+  void begin();
+
+  #ifdef ARDUINO_ARCH_SAMD
+  // Routes the shared 1MHz generic clock to a peripheral (GCLK_CLKCTRL_ID_*).
+  void routeMicrosecondClock(uint16_t clockId);
+
+  inline unsigned long now(){
+    return TC4->COUNT32.COUNT.reg;
+  }
+  #else
+  inline unsigned long now(){
+    return micros();
+  }
+  #endif
+}
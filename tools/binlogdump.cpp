@@ -0,0 +1,109 @@
+/*
+  Formats the binary log the firmware writes to SerialUSB (see remoteemulator/binlog.h).
+
+  g++ -std=c++17 -Itools/host -Iremoteemulator tools/binlogdump.cpp -o binlogdump
+  binlogdump /dev/ttyACM0      or      binlogdump < capture.bin
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "binlog.h"
+
+static const char *names[] = {
+  "?", "BOOT", "BUS_RESET", "CHECKSUM_ERROR", "QUEUE_OVERFLOW", "UNKNOWN_PACKET",
+  "UNKNOWN_CAPABILITY", "LCD_TEXT", "LCD_CHARS", "UNKNOWN_LCD", "TRACK_NUMBER",
+  "BUTTON_DEQUEUE", "BUTTON_UP", "BUTTON_DOWN", "LOG_OVERFLOW", "REMOTE_MESSAGE",
+  "PIN_MISMATCH"
+};
+static_assert(sizeof(names) / sizeof(*names) == static_cast<int>(LogId::ID_COUNT), "names[] out of date with LogId");
+
+// ResetReason / EventLCDText::LCDDataType, by number
+static const char *resetReasons[] = { "PRESYNC", "SYNC", "REMOTE_SENT", "MESSAGE_RECEIVED", "TIMEOUT" };
+static const char *lcdTypes[] = { "UNKNOWN", "TIME", "DISC_TITLE", "TRACK_TITLE" };
+
+template<size_t N>
+static const char *nameOf(const char *(&names)[N], unsigned value){ return value < N ? names[value] : "?"; }
+
+static std::string printable(const std::string &text){
+  std::string out;
+  char hex[8];
+  for(unsigned char c : text){
+    if(c < 0x20 || c >= 0x7f){
+      snprintf(hex, sizeof(hex), "[%02x]", c);
+      out += hex;
+    }else out += c;
+  }
+  return out;
+}
+
+int main(int argc, char **argv){
+  FILE *in = argc > 1 ? fopen(argv[1], "rb") : stdin;
+  if(!in){
+    perror(argv[1]);
+    return 1;
+  }
+
+  uint8_t window[sizeof(LogRecord)];
+  size_t filled = 0;
+  unsigned long skipped = 0;
+  std::string text;
+  uint32_t textLength = 0, textTime = 0, textType = 0;
+  LogId textId = LogId::LCD_TEXT;
+
+  int c;
+  while((c = fgetc(in)) != EOF){
+    window[filled++] = c;
+    if(window[0] != BINLOG_MAGIC){
+      ++skipped;
+      filled = 0;
+      continue;
+    }
+    if(filled < sizeof(LogRecord)) continue;
+
+    LogRecord record;
+    memcpy(&record, window, sizeof(record));
+    if(record.id == 0 || record.id >= static_cast<uint8_t>(LogId::ID_COUNT)){
+      // Not a record after all - resume at the next magic byte already in the window
+      do{
+        memmove(window, window + 1, --filled);
+        ++skipped;
+      }while(filled && window[0] != BINLOG_MAGIC);
+      continue;
+    }
+    filled = 0;
+
+    LogId id = static_cast<LogId>(record.id);
+    if(id == LogId::LCD_CHARS && text.size() < textLength){
+      for(int i = 0; i<4 && text.size() < textLength; i++) text += (char) (record.b >> (8 * i));
+      if(text.size() == textLength && textId == LogId::REMOTE_MESSAGE){
+        printf("%10u REMOTE_MESSAGE [%02x]", textTime, textType);
+        for(unsigned char c : text) printf(" %02x", c);
+        printf("\n");
+      }else if(text.size() == textLength){
+        printf("%10u LCD_TEXT %s \"%s\"\n", textTime, nameOf(lcdTypes, textType), printable(text).c_str());
+      }
+      continue;
+    }
+
+    switch(id){
+      case LogId::LCD_TEXT:
+      case LogId::REMOTE_MESSAGE:
+        textId = id;
+        text.clear();
+        textLength = record.b;
+        textTime = record.time;
+        textType = record.a;
+        if(!textLength) printf("%10u LCD_TEXT %s \"\"\n", record.time, nameOf(lcdTypes, textType));
+        break;
+      case LogId::BUS_RESET:
+        printf("%10u BUS_RESET %s\n", record.time, nameOf(resetReasons, record.a));
+        break;
+      default:
+        printf("%10u %s %u 0x%x\n", record.time, names[record.id], record.a, record.b);
+        break;
+    }
+  }
+  if(skipped) fprintf(stderr, "%lu bytes outside of records skipped\n", skipped);
+  return 0;
+}
@@ -0,0 +1,417 @@
+/*
+  Bridge simulator - a player and a remote on two separate buses with BusBridge in between.
+  Both lines are wired-AND: every party pulls its own low and the line is high only when
+  nobody does. The player runs the timings from busgen.h and reads the remote's bits back
+  from the line, the remote is a BusDecoder answering through its own pulse timer.
+  Every reaction of the bridge takes --latency us (+ up to --jitter us), the endpoints
+  react within ENDPOINT_LATENCY. The report shows the forwarding delay in both directions,
+  how much of the player's ~200us gap a forwarded remote bit used up, and whether every
+  header bit and message still arrived intact.
+
+  g++ -std=c++17 -O2 -Itools/host -Iremoteemulator tools/bridgesim.cpp remoteemulator/busbridge.cpp \
+      remoteemulator/sonyremote.cpp remoteemulator/asyncsonyremote.cpp remoteemulator/remotepackets.cpp \
+      remoteemulator/pulsetimer.cpp remoteemulator/timebase.cpp remoteemulator/bitclassifier.cpp \
+      remoteemulator/binlog.cpp -o bridgesim
+
+  bridgesim [--frames N] [--seed N] [--latency us] [--jitter us] [--answer] [--rewrite]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+#include "busbridge.h"
+#include "busgen.h"
+#include "offlineremote.h"
+
+#define PLAYER_PIN 3
+#define REMOTE_PIN 4
+#define ENDPOINT_LATENCY 2 /*us - the player's and the remote's own reaction to an edge*/
+#define REWRITE_TEXT "Bridged"
+
+typedef HostPin<PLAYER_PIN> PlayerLine;
+typedef HostPin<REMOTE_PIN> RemoteLine;
+typedef std::chrono::steady_clock Clock;
+
+/*******************************Event queue*******************************/
+struct SimEvent{
+  uint64_t time;
+  uint64_t order;
+  std::function<void()> action;
+  bool operator>(const SimEvent &other) const { return time != other.time ? time > other.time : order > other.order; }
+};
+
+static std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent>> pending;
+static uint64_t eventOrder = 0;
+
+static void at(uint64_t time, std::function<void()> action){
+  pending.push({ time, eventOrder++, action });
+}
+
+static std::mt19937 jitterRandom;
+static double latency = 5, jitter = 0;
+
+static uint64_t bridgeReaction(){
+  return latency + (jitter > 0 ? std::uniform_real_distribution<double>(0, jitter)(jitterRandom) : 0);
+}
+
+struct Stats{
+  uint64_t min = UINT64_MAX, max = 0, total = 0, count = 0;
+  void add(uint64_t v){
+    if(v < min) min = v;
+    if(v > max) max = v;
+    total += v;
+    ++count;
+  }
+  void print(const char *name){
+    if(!count) printf("%-18s -\n", name);
+    else printf("%-18s min %llu  mean %.1f  max %llu us over %llu\n", name, (unsigned long long) min, (double) total / count,
+      (unsigned long long) max, (unsigned long long) count);
+  }
+};
+
+static Stats playerToRemote, remoteToPlayer, gapUsed;
+static Clock::duration isrTime = Clock::duration::zero();
+static uint64_t isrCalls = 0;
+
+/*******************************Bus lines*******************************/
+enum Party{ ENDPOINT, BRIDGE };
+
+struct Line{
+  Line(uint8_t pin, volatile bool *level) : pin(pin), level(level){}
+
+  uint8_t pin;
+  volatile bool *level;
+  bool pulls[2] = {};
+  uint64_t lastFall = 0, lastRise = 0;
+  std::function<void(bool)> endpoint;    // The player's / remote's view of the line
+  std::function<void(Party, bool)> onPull;
+
+  void pull(Party who, bool low){
+    if(pulls[who] == low) return;
+    pulls[who] = low;
+    if(onPull) onPull(who, low);
+    bool next = !(pulls[ENDPOINT] || pulls[BRIDGE]);
+    if(next == *level) return;
+    *level = next;
+    (next ? lastRise : lastFall) = host::now;
+    if(endpoint) endpoint(next);
+    Clock::time_point start = Clock::now();
+    host::isrs[pin]();
+    isrTime += Clock::now() - start;
+    ++isrCalls;
+  }
+};
+
+static Line playerLine(PLAYER_PIN, &PlayerLine::level);
+static Line remoteLine(REMOTE_PIN, &RemoteLine::level);
+
+// A pulse timer whose pin pulls one party's side of a line.
+class LinePulseTimer : public PulseTimer{
+  public:
+  LinePulseTimer(Line &line, Party who, bool bridge) : line(line), who(who), bridge(bridge){}
+  virtual void begin(){}
+  virtual void pulse(uint16_t duration){
+    uint64_t start = host::now + (bridge ? bridgeReaction() : ENDPOINT_LATENCY);
+    uint32_t id = ++generation;
+    releaseTime = start + duration;
+    at(start, [this](){ line.pull(who, true); });
+    at(start + duration, [this, id](){ if(id == generation) line.pull(who, false); });
+  }
+  virtual bool isPulsing(){ return host::now < releaseTime; }
+
+  private:
+  Line &line;
+  Party who;
+  bool bridge;
+  uint32_t generation = 0;
+  uint64_t releaseTime = 0;
+};
+
+// The bridge's mirror of the player's lows on the remote's bus. The ISR handles edges
+// in order, so a write never overtakes the previous one however the latency jitters.
+struct RemoteSink{
+  static uint64_t last;
+  static void begin(){}
+  static void write(bool value){
+    last = std::max<uint64_t>(host::now + bridgeReaction(), last);
+    at(last, [value](){ remoteLine.pull(BRIDGE, value); });
+  }
+};
+uint64_t RemoteSink::last = 0;
+
+/*******************************Player*******************************/
+// Plays busgen.h's frames on a real line: every slot is the player's own low, the width
+// it reads back is from the line's fall to its rise, so stretched lows read as 1s.
+struct PlayerModel{
+  BusTiming timing;
+  BusFrame frame;
+  std::function<void()> frameDone;
+
+  uint8_t phase = 0;
+  bool waitingForHigh = false;
+  uint8_t remoteHeader;
+  uint8_t remotePayload[11];
+
+  void start(){
+    phase = 0;
+    remoteHeader = 0;
+    memset(remotePayload, 0, sizeof(remotePayload));
+    at(host::now + timing.high, [this](){ slot(); });
+  }
+
+  // Width of the player's own low in the current slot, 0 after the last slot
+  double width(){
+    if(phase == 0) return timing.presync;
+    if(phase == 1) return timing.sync;
+    if(phase < 10) return timing.zero;
+    uint8_t playerHeader = (frame.hasData ? 0 : 0x01) | (frame.cedeBus ? 0x10 : 0) | 0x80;
+    if(phase < 18) return playerHeader & (1 << (phase - 10)) ? timing.one : timing.zero;
+    if(frame.hasData && !frame.cedeBus){
+      uint8_t bit = phase - 18;
+      if(bit >= 88) return 0;
+      return frame.payload[bit >> 3] & (1 << (bit & 0b111)) ? timing.one : timing.zero;
+    }
+    if(frame.cedeBus && (remoteHeader & 0x10)) return phase < 18 + 89 ? timing.zero : 0;
+    return 0;
+  }
+
+  void slot(){
+    double w = width();
+    if(w == 0){
+      frameDone();
+      return;
+    }
+    playerLine.pull(ENDPOINT, true);
+    at(host::now + w, [this](){
+      playerLine.pull(ENDPOINT, false);
+      if(playerLine.lastRise == host::now) read();
+      else waitingForHigh = true;
+    });
+  }
+
+  void lineChanged(bool level){
+    if(!level || !waitingForHigh) return;
+    waitingForHigh = false;
+    read();
+  }
+
+  // Slot over - classify the line's low and start the next one after the gap
+  void read(){
+    bool b = playerLine.lastRise - playerLine.lastFall > (timing.zero + timing.one) / 2;
+    if(phase >= 2 && phase < 10) remoteHeader |= b << (phase - 2);
+    if(phase >= 19 && frame.cedeBus){
+      uint8_t bit = phase - 19;
+      remotePayload[bit >> 3] |= b << (bit & 0b111);
+    }
+    ++phase;
+    at(host::now + ENDPOINT_LATENCY + timing.high, [this](){ slot(); });
+  }
+};
+
+/*******************************Messages*******************************/
+// Track titles (LCD text starting with 0x14) reach the remote as REWRITE_TEXT.
+// Decided byte by byte, so it only looks at bytes that are already on the bus.
+static int16_t rewriteTitles(const volatile uint8_t *message, uint8_t index){
+  static bool firstSegment = true, title = false;
+  static uint8_t written = 0;
+  if(index < 3 || message[0] != 0xc8) return -1;
+  if(firstSegment){
+    if(index == 3) return -1; // The LCD type
+    if(index == 4){
+      title = message[3] == 0x14;
+      written = 0;
+    }
+  }
+  int16_t out = -1;
+  if(title) out = written < sizeof(REWRITE_TEXT) - 1 ? REWRITE_TEXT[written++] : 0xff;
+  if(index == 9) firstSegment = message[1] == 0x01;
+  return out;
+}
+
+// What the remote answers a capability request with, and what prepareRemoteCapabilities() sends
+static const uint8_t remoteCapabilities[11] = { 0xc0, 0x01, 0x09, 0x00, 0x00, 0x10, 0x0c, 0x80, 0x20, 0x10, 0x64 };
+static const uint8_t bridgeCapabilities[11] = { 0xc0, 0x01, 0xff, 0x00, 0x00, 0x20, 0x0c, 0x80, 0x20, 0x10, 0xa2 };
+
+int main(int argc, char **argv){
+  unsigned long frames = 5000;
+  uint32_t seed = 1;
+  bool answer = false, rewrite = false;
+
+  for(int i = 1; i<argc; i++){
+    std::string opt = argv[i];
+    if(opt == "--answer") answer = true;
+    else if(opt == "--rewrite") rewrite = true;
+    else if(opt == "--frames" && i + 1 < argc) frames = strtoul(argv[++i], NULL, 10);
+    else if(opt == "--seed" && i + 1 < argc) seed = strtoul(argv[++i], NULL, 10);
+    else if(opt == "--latency" && i + 1 < argc) latency = atof(argv[++i]);
+    else if(opt == "--jitter" && i + 1 < argc) jitter = atof(argv[++i]);
+    else{
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  jitterRandom.seed(seed);
+
+  LinePulseTimer playerTimer(playerLine, BRIDGE, true);
+  LinePulseTimer remoteTimer(remoteLine, BRIDGE, true);
+  BusBridge<PlayerLine, RemoteLine, RemoteSink> bridge(&playerTimer, &remoteTimer);
+  bridge.setAnswerCapabilities(answer);
+  if(rewrite) bridge.setRewrite(rewriteTitles);
+  bridge.begin();
+
+  // The real remote: decodes its bus and answers through its own sink
+  LinePulseTimer remoteSink(remoteLine, ENDPOINT, false);
+  BusDecoder remote;
+  remote.pulseTimer = &remoteSink;
+  OfflineRemote remoteDisplay;
+
+  PlayerModel player;
+  playerLine.endpoint = [&](bool level){ player.lineChanged(level); };
+  remoteLine.endpoint = [&](bool level){ remote.decodeEdge(level, host::now); };
+
+  // Forwarding delays, measured on the lines
+  uint64_t remoteWrite = 0;
+  uint32_t forwarded = 0;
+  bool remoteWriting = false;
+  playerLine.onPull = [&](Party who, bool low){
+    if(!low || !remoteWriting) return;
+    if(who == ENDPOINT || bridge.getForwardedBits() == forwarded){
+      remoteWriting = false; // The bit wasn't forwarded in time, or at all
+      return;
+    }
+    remoteToPlayer.add(host::now - remoteWrite);
+    gapUsed.add(host::now - playerLine.lastRise);
+    remoteWriting = false;
+  };
+  remoteLine.onPull = [&](Party who, bool low){
+    if(!low) return;
+    if(who == BRIDGE) playerToRemote.add(host::now - playerLine.lastFall);
+    else if(!remoteLine.pulls[BRIDGE] && *playerLine.level){
+      remoteWrite = host::now;
+      forwarded = bridge.getForwardedBits();
+      remoteWriting = true;
+    }
+  };
+
+  std::mt19937 pickRandom(seed);
+  double mix[4] = { 6, 1, 2, 1 }; // text, track, volume, capabilities
+  std::discrete_distribution<int> pick(mix, mix + 4);
+  std::deque<Payload> queued, sent;
+  std::deque<std::string> expectedTexts;
+  char text[32];
+  uint8_t track = 1, volume = 10;
+
+  unsigned long playerMessages = 0, delivered = 0, corrupted = 0, textMismatches = 0, textsShown = 0;
+  unsigned long headerErrors = 0, remoteMessages = 0, remoteErrors = 0, fromBridge = 0, fromRemote = 0;
+  unsigned long f = 0;
+  uint8_t expectedHeader = 0;
+  bool remoteWantsBus = false;
+
+  std::function<void()> nextFrame = [&](){
+    player.frame = BusFrame();
+    if(remoteWantsBus){
+      player.frame.cedeBus = true;
+    }else{
+      if(queued.empty()){
+        switch(pick(pickRandom)){
+          case 0:
+            if(pickRandom() & 1) snprintf(text, sizeof(text), " %u %02lu:%02lu", track, (f / 60) % 60, f % 60);
+            else snprintf(text, sizeof(text), "\x14Track number %u", track);
+            textSegments(queued, text);
+            expectedTexts.push_back(rewrite && text[0] == 0x14 ? REWRITE_TEXT : text + 1);
+            break;
+          case 1:
+            track = track % 30 + 1;
+            queued.push_back(framePayload({ 0xa0, 0x01, 0x00, 0x00, track }));
+            break;
+          case 2:
+            volume = pickRandom() % 31;
+            queued.push_back(framePayload({ 0x40, volume }));
+            break;
+          case 3:
+            queued.push_back(framePayload({ 0x01, 0x01 }));
+            break;
+        }
+      }
+      player.frame.hasData = true;
+      memcpy(player.frame.payload, queued.front().bytes, 11);
+      sent.push_back(queued.front());
+      queued.pop_front();
+      ++playerMessages;
+    }
+    bool bridgeSends = bridge.getPendingMessages();
+    expectedHeader = 0x82 | (remote.hasOutbound() || bridgeSends ? 0x10 : 0);
+
+    player.frameDone = [&, bridgeSends](){
+      if(player.remoteHeader != expectedHeader) ++headerErrors;
+      if(player.frame.cedeBus && (player.remoteHeader & 0x10)){
+        ++remoteMessages;
+        const uint8_t *expected = bridgeSends ? bridgeCapabilities : remoteCapabilities;
+        if(memcmp(player.remotePayload, expected, 11)) ++remoteErrors;
+        else ++(bridgeSends ? fromBridge : fromRemote);
+      }
+      remoteWantsBus = player.remoteHeader & 0x10 && !player.frame.cedeBus;
+
+      // The main loops
+      while(bridge.handleMessage()) while(bridge.nextEvent());
+      BusDecoder::Message *message;
+      while((message = remote.messageQueue.front())){
+        Payload original = sent.front();
+        sent.pop_front();
+        ++delivered;
+        if(message->data[0] == 0x01) remote.queueOutbound(remoteCapabilities, OutboundPriority::RESPONSE, 0, host::now);
+        bool valid = true;
+        uint8_t sum = 0;
+        for(uint8_t i = 0; i<11; i++) sum ^= message->data[i];
+        if(sum || (memcmp(message->data, original.bytes, 11) && !(rewrite && original.bytes[0] == 0xc8))) valid = false;
+        if(!valid) ++corrupted;
+        remoteDisplay.handle(message->data);
+        RemoteEvent *event;
+        while((event = remoteDisplay.nextEvent())){
+          if(event->type != EventType::LCD_TEXT) continue;
+          ++textsShown;
+          if(expectedTexts.empty() || expectedTexts.front() != event->data.lcd.text) ++textMismatches;
+          if(!expectedTexts.empty()) expectedTexts.pop_front();
+        }
+        remote.messageQueue.drop();
+        remote.bitClassifier.recalibrate();
+      }
+      if(++f < frames) at(host::now, nextFrame);
+    };
+    player.start();
+  };
+
+  Clock::time_point wallStart = Clock::now();
+  nextFrame();
+  while(!pending.empty()){
+    SimEvent event = pending.top();
+    pending.pop();
+    host::now = event.time;
+    event.action();
+  }
+  double wall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+
+  printf("frames             %lu, bridge latency %.0f us + up to %.0f us\n", frames, latency, jitter);
+  printf("player messages    %lu, %lu reached the remote, %lu corrupted\n", playerMessages, delivered, corrupted);
+  printf("LCD texts          %lu shown by the remote, %lu wrong%s\n", textsShown, textMismatches, rewrite ? " (titles rewritten)" : "");
+  printf("rewritten          %u messages\n", bridge.getRewrittenMessages());
+  printf("remote headers     %lu wrong\n", headerErrors);
+  printf("remote messages    %lu, %lu from the remote, %lu injected by the bridge, %lu corrupted\n", remoteMessages, fromRemote, fromBridge, remoteErrors);
+  printf("forwarded bits     %u, %u dropped for injected messages\n", bridge.getForwardedBits(), bridge.getDroppedBits());
+  playerToRemote.print("player -> remote");
+  remoteToPlayer.print("remote -> player");
+  gapUsed.print("gap used");
+  printf("bit period         %u us (DATA_DURATION), player gap %.0f us\n", DATA_DURATION, player.timing.high);
+  printf("bus time           %.2f s\n", host::now / 1e6);
+  printf("host time          %.3f s, ISR cost %.1f ns/edge\n", wall,
+    isrCalls ? std::chrono::duration<double, std::nano>(isrTime).count() / isrCalls : 0);
+
+  bool ok = !corrupted && !textMismatches && !headerErrors && !remoteErrors && delivered == playerMessages
+    && remoteToPlayer.max < DATA_DURATION && playerToRemote.max < DATA_DURATION;
+  return ok ? 0 : 2;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+/*
+  Generates the player's side of the bus as an edge stream:
+  presync, sync, remote header, player header and (optionally) 88 data bits per frame.
+  Every bit is a low pulse followed by a high gap; a 1 is a long low pulse.
+
+  The remote answers by stretching low pulses (the header, and whole messages when the
+  player cedes the bus). The generator asks remoteDrives() before each of those pulses,
+  so a decoder with a SimulatedPulseTimer can be looped back into the stream.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <initializer_list>
+#include <random>
+
+struct BusTiming{
+  double presync = 1120;
+  double reset = 42000; // Presync of a frame that resets the bus (PRESYNC_RESET_RANGE)
+  double sync = 220;
+  double high = 200;  // Gap between low pulses
+  double zero = 180;
+  double one = 400;
+  double jitter = 0;  // +- us, uniform, applied to every pulse
+  double drift = 0;   // Relative change of all widths per frame, e.g. 0.0001
+};
+
+struct BusFrame{
+  bool hasData = false;
+  bool cedeBus = false;
+  bool reset = false;            // Starts with timing.reset instead of the presync
+  uint8_t payload[11] = {};
+  uint8_t remoteHeader = 0;      // Filled in by the generator from remoteDrives()
+  uint8_t remotePayload[11] = {}; // Bits the remote drove while the player ceded the bus
+};
+
+class BusGenerator{
+  public:
+  BusGenerator(const BusTiming &timing, uint32_t seed) : timing(timing), random(seed){}
+
+  // edge(level, time) delivers one edge, remoteDrives() returns whether the remote
+  // stretched the upcoming low pulse.
+  template<typename Edge, typename RemoteDrives>
+  void frame(BusFrame &frame, Edge edge, RemoteDrives remoteDrives){
+    low(edge, frame.reset ? timing.reset : timing.presync);
+    low(edge, timing.sync);
+
+    frame.remoteHeader = 0;
+    for(uint8_t i = 0; i<8; i++){
+      bool b = remoteDrives();
+      frame.remoteHeader |= b << i;
+      low(edge, b ? timing.one : timing.zero);
+    }
+
+    uint8_t playerHeader = (frame.hasData ? 0 : 0x01) | (frame.cedeBus ? 0x10 : 0) | 0x80;
+    for(uint8_t i = 0; i<8; i++) bit(edge, playerHeader & (1 << i));
+
+    if(frame.hasData && !frame.cedeBus){
+      for(uint8_t i = 0; i<88; i++) bit(edge, frame.payload[i >> 3] & (1 << (i & 0b111)));
+    }else if(frame.cedeBus && (frame.remoteHeader & 0x10)){
+      // The remote starts driving one pulse after the player header
+      low(edge, timing.zero);
+      for(uint8_t i = 0; i<88; i++){
+        bool b = remoteDrives();
+        if(b) frame.remotePayload[i >> 3] |= 1 << (i & 0b111);
+        low(edge, b ? timing.one : timing.zero);
+      }
+    }
+
+    scale *= 1 + timing.drift;
+  }
+
+  uint64_t now = 0;
+  uint64_t edges = 0;
+
+  private:
+  template<typename Edge>
+  void bit(Edge &edge, bool b){ low(edge, b ? timing.one : timing.zero); }
+
+  template<typename Edge>
+  void low(Edge &edge, double length){
+    edge(false, now += width(timing.high));
+    edge(true, now += width(length));
+    edges += 2;
+  }
+
+  uint64_t width(double nominal){
+    double w = nominal * scale;
+    if(timing.jitter > 0) w += std::uniform_real_distribution<double>(-timing.jitter, timing.jitter)(random);
+    return w < 1 ? 1 : (uint64_t) w;
+  }
+
+  BusTiming timing;
+  std::mt19937 random;
+  double scale = 1;
+};
+
+// Player messages - 10 payload bytes + xor checksum.
+inline void finishMessage(uint8_t *payload){
+  uint8_t sum = 0;
+  for(uint8_t i = 0; i<10; i++) sum ^= payload[i];
+  payload[10] = sum;
+}
+
+struct Payload{
+  uint8_t bytes[11];
+};
+
+// A finished frame from its leading bytes, the rest zero
+inline Payload framePayload(std::initializer_list<uint8_t> bytes){
+  Payload p = {};
+  uint8_t i = 0;
+  for(uint8_t b : bytes) p.bytes[i++] = b;
+  finishMessage(p.bytes);
+  return p;
+}
+
+// LCD text as DisplayText segments of 7 characters, the last one marked final
+inline void textSegments(std::deque<Payload> &out, const char *text){
+  size_t length = strlen(text);
+  for(size_t offset = 0; offset < length || offset == 0; offset += 7){
+    Payload p;
+    memset(p.bytes, 0xff, sizeof(p.bytes));
+    p.bytes[0] = 0xc8;
+    p.bytes[1] = offset + 7 >= length ? 0x01 : 0x02; // 0x01 - final segment
+    p.bytes[2] = 0x00;
+    for(size_t i = 0; i<7 && offset + i < length; i++) p.bytes[3 + i] = text[offset + i];
+    finishMessage(p.bytes);
+    out.push_back(p);
+  }
+}
@@ -0,0 +1,342 @@
+/*
+  Player bus simulator - load-tests AsyncSonyRemote without a player attached.
+  Generates presync / sync / header / data edges for a mix of player messages and feeds
+  them to the decoder's ISR through HostPin and the simulated micros() clock. The remote's
+  answers (header bits, capability response) are looped back through SimulatedPulseTimer.
+  With --buses N every bus gets its own AsyncSonyRemote on its own pin, fed frame by frame
+  in turn as if N players were attached to one board.
+
+  The ISR cost is measured separately: the edges of all buses are recorded, merged by
+  time and replayed into fresh remotes in timed batches, so the figure isn't swamped by
+  the clock reads.
+
+  --spread sends a text's segments that many frames apart, other messages in between, and
+  --write stores bus 0's edges as an .edges capture (see capreplay) - together they make a
+  capture for pardecode --check.
+
+  g++ -std=c++17 -O2 -Itools/host -Iremoteemulator tools/bussim.cpp remoteemulator/sonyremote.cpp \
+      remoteemulator/asyncsonyremote.cpp remoteemulator/remotepackets.cpp remoteemulator/pulsetimer.cpp \
+      remoteemulator/timebase.cpp remoteemulator/bitclassifier.cpp remoteemulator/binlog.cpp \
+      remoteemulator/eventcoalescer.cpp remoteemulator/edgecapture.cpp -lz -o bussim
+
+  bussim [--frames N] [--buses N] [--seed N] [--jitter us] [--drift ratio] [--zero us] [--one us]
+         [--mix text,track,volume,battery] [--drain frames] [--coalesce 0|1] [--subscribe mask]
+         [--send ratio] [--max-age ms] [--spread frames] [--write out.edges]
+
+  --drain reads the events every N frames instead of after each one, --coalesce puts an
+  EventCoalescer in front (volume / battery / playback mode repeats dropped). --subscribe takes
+  a hex EVENT_MASK() set for SonyRemote::setSubscriptions(), e.g. 0x20e for the sketch's.
+  --send queues a BACKGROUND message from the remote in that share of frames (dropped after
+  --max-age), and the player asks for the capabilities every 200 frames; their answers should
+  overtake the background traffic.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "sonyremote.h"
+#include "eventcoalescer.h"
+#include "busgen.h"
+#include "capture.h"
+
+#define SIM_PIN 3
+#define MAX_BUSES 8
+#define BENCH_BATCH 64 /*Edges per clock read in the ISR benchmark*/
+
+typedef std::chrono::steady_clock Clock;
+
+/*******************************Buses*******************************/
+// One remote per pin - every HostPin<SIM_PIN + n> has its own ISR trampoline.
+struct BusPort{
+  AsyncSonyRemoteBase *(*create)(PulseTimer *pulseTimer);
+  volatile bool *level;
+  uint8_t pin;
+};
+
+template<uint8_t Pin>
+static AsyncSonyRemoteBase *createRemote(PulseTimer *pulseTimer){
+  AsyncSonyRemote<HostPin<Pin>> *remote = new AsyncSonyRemote<HostPin<Pin>>(pulseTimer);
+  remote->begin();
+  return remote;
+}
+
+template<uint8_t Pin>
+static BusPort port(){
+  return { createRemote<Pin>, &HostPin<Pin>::level, Pin };
+}
+
+static const BusPort ports[MAX_BUSES] = {
+  port<SIM_PIN>(), port<SIM_PIN + 1>(), port<SIM_PIN + 2>(), port<SIM_PIN + 3>(),
+  port<SIM_PIN + 4>(), port<SIM_PIN + 5>(), port<SIM_PIN + 6>(), port<SIM_PIN + 7>()
+};
+
+struct RecordedEdge{
+  uint32_t time; // Like the device's timebase
+  uint8_t bus;
+  bool level;
+};
+
+struct SimBus{
+  SimBus(const BusTiming &timing, uint32_t seed) : generator(timing, seed), random(seed),
+    coalescer(EVENT_MASK(EventType::VOLUME_LEVEL) | EVENT_MASK(EventType::BATTERY_LEVEL) | EVENT_MASK(EventType::PLAYBACK_MODE)){}
+
+  const BusPort *port;
+  SimulatedPulseTimer pulseTimer;
+  std::unique_ptr<AsyncSonyRemoteBase> remote;
+  BusGenerator generator;
+  std::mt19937 random;
+  std::deque<Payload> pending;
+  EventCoalescer coalescer;
+  bool remoteWantsBus = false;
+  uint32_t pulsesSeen = 0;
+  uint8_t track = 1, volume = 10;
+  unsigned long nextSegment = 0; // --spread: frame the next text segment may go out
+  unsigned long playerMessages = 0, remoteMessages = 0, events = 0;
+  unsigned long capabilityAnswers = 0, remoteErrors = 0, answerFrames = 0, answerFramesMax = 0;
+  unsigned long capabilitiesAsked = 0; // Frame of the last request
+  unsigned long eventsByType[EVENT_TYPES] = {};
+};
+
+static bool coalesce = false;
+
+// Like the sketch's main loop - everything that came in since the events were last read, in one span
+static void drain(SimBus &bus, bool readEvents = true){
+  while(bus.remote->handleMessage());
+  if(!readEvents) return;
+  EventSpan events = bus.remote->drainEvents();
+  if(coalesce) events = bus.coalescer.filter(events);
+  for(RemoteEvent &event : events){
+    ++bus.events;
+    ++bus.eventsByType[static_cast<int>(event.type)];
+  }
+}
+
+int main(int argc, char **argv){
+  BusTiming timing;
+  unsigned long frames = 10000;
+  unsigned buses = 1;
+  unsigned long drainEvery = 1, spread = 0;
+  uint16_t subscriptions = 0xffff;
+  double sendRatio = 0, maxAge = 500;
+  uint32_t seed = 1;
+  double mix[4] = { 6, 1, 2, 1 }; // text, track, volume, battery
+  std::string writePath;
+
+  for(int i = 1; i + 1 < argc; i += 2){
+    std::string opt = argv[i];
+    const char *value = argv[i + 1];
+    if(opt == "--frames") frames = strtoul(value, NULL, 10);
+    else if(opt == "--buses") buses = strtoul(value, NULL, 10);
+    else if(opt == "--drain") drainEvery = std::max(1ul, strtoul(value, NULL, 10));
+    else if(opt == "--coalesce") coalesce = atoi(value);
+    else if(opt == "--subscribe") subscriptions = strtoul(value, NULL, 16);
+    else if(opt == "--send") sendRatio = atof(value);
+    else if(opt == "--max-age") maxAge = atof(value);
+    else if(opt == "--seed") seed = strtoul(value, NULL, 10);
+    else if(opt == "--jitter") timing.jitter = atof(value);
+    else if(opt == "--drift") timing.drift = atof(value);
+    else if(opt == "--zero") timing.zero = atof(value);
+    else if(opt == "--one") timing.one = atof(value);
+    else if(opt == "--mix") sscanf(value, "%lf,%lf,%lf,%lf", &mix[0], &mix[1], &mix[2], &mix[3]);
+    else if(opt == "--spread") spread = strtoul(value, NULL, 10);
+    else if(opt == "--write") writePath = value;
+    else{
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if(buses < 1 || buses > MAX_BUSES){
+    fprintf(stderr, "--buses must be 1 - %d\n", MAX_BUSES);
+    return 1;
+  }
+
+  std::unique_ptr<EdgeCaptureWriter> writer;
+  if(!writePath.empty()){
+    FILE *out = fopen(writePath.c_str(), "wb");
+    if(!out){
+      fprintf(stderr, "%s: %s\n", writePath.c_str(), strerror(errno));
+      return 1;
+    }
+    writer.reset(new EdgeCaptureWriter(out));
+  }
+
+  std::vector<std::unique_ptr<SimBus>> sim;
+  for(unsigned b = 0; b<buses; b++){
+    SimBus *bus = new SimBus(timing, seed + b);
+    bus->port = &ports[b];
+    bus->remote.reset(bus->port->create(&bus->pulseTimer));
+    bus->remote->setSubscriptions(subscriptions);
+    bus->pending.push_back(framePayload({ 0x01, 0x01 })); // Players ask for the capabilities once, at start
+    sim.emplace_back(bus);
+  }
+
+  std::discrete_distribution<int> pick(mix, mix + 4);
+  std::uniform_real_distribution<double> chance(0, 1);
+  const Payload background = framePayload({ 0xc1, 0x00 }); // Nothing the player knows - only fills the queue
+  std::vector<RecordedEdge> recorded;
+  char text[32];
+
+  Clock::time_point wallStart = Clock::now();
+  for(unsigned long f = 0; f<frames; f++){
+    for(unsigned b = 0; b<buses; b++){
+      SimBus &bus = *sim[b];
+      BusFrame frame;
+      if(sendRatio > 0 && chance(bus.random) < sendRatio){
+        bus.remote->sendMessage(background.bytes, OutboundPriority::BACKGROUND, maxAge * 1000);
+      }
+      if(sendRatio > 0 && f % 200 == 100) bus.pending.push_front(framePayload({ 0x01, 0x01 }));
+      if(bus.remoteWantsBus){
+        frame.cedeBus = true;
+      }else{
+        // Other messages go in front of a text that has to wait
+        bool waiting = !bus.pending.empty() && f < bus.nextSegment;
+        if(bus.pending.empty() || waiting){
+          int kind = pick(bus.random);
+          if(waiting && kind == 0) kind = 2;
+          switch(kind){
+            case 0:
+              if(bus.random() & 1){
+                snprintf(text, sizeof(text), " %u %02lu:%02lu", bus.track, (f / 60) % 60, f % 60);
+              }else{
+                snprintf(text, sizeof(text), "\x14Track number %u", bus.track);
+              }
+              textSegments(bus.pending, text);
+              break;
+            case 1:
+              bus.track = bus.track % 30 + 1;
+              bus.pending.push_front(framePayload({ 0xa0, 0x01, 0x00, 0x00, bus.track }));
+              break;
+            case 2:
+              bus.volume = bus.random() % 31;
+              bus.pending.push_front(framePayload({ 0x40, bus.volume }));
+              break;
+            case 3:
+              bus.pending.push_front(framePayload({ 0x43, 0xbf, 0x41, 0x00 }));
+              break;
+          }
+        }
+        frame.hasData = true;
+        if(bus.pending.front().bytes[0] == 0x01) bus.capabilitiesAsked = f;
+        if(bus.pending.front().bytes[0] == 0xc8) bus.nextSegment = f + spread;
+        memcpy(frame.payload, bus.pending.front().bytes, 11);
+        bus.pending.pop_front();
+        ++bus.playerMessages;
+      }
+
+      void (*isr)() = host::isrs[bus.port->pin];
+      auto edge = [&](bool level, uint64_t time){
+        host::now = time;
+        *bus.port->level = level;
+        isr();
+        recorded.push_back({ (uint32_t) time, (uint8_t) b, level });
+        if(writer && b == 0) writer->add(level, time * 1000);
+      };
+      auto remoteDrives = [&](){
+        bool driven = bus.pulseTimer.pulses != bus.pulsesSeen;
+        bus.pulsesSeen = bus.pulseTimer.pulses;
+        return driven;
+      };
+      bus.generator.frame(frame, edge, remoteDrives);
+      if(frame.cedeBus && (frame.remoteHeader & 0x10)){
+        ++bus.remoteMessages;
+        uint8_t sum = 0;
+        for(uint8_t i = 0; i<11; i++) sum ^= frame.remotePayload[i];
+        if(sum) ++bus.remoteErrors;
+        else if(frame.remotePayload[0] == 0xc0){
+          ++bus.capabilityAnswers;
+          bus.answerFrames += f - bus.capabilitiesAsked;
+          bus.answerFramesMax = std::max(bus.answerFramesMax, f - bus.capabilitiesAsked);
+        }
+      }
+      bus.remoteWantsBus = frame.remoteHeader & 0x10 && !frame.cedeBus;
+      drain(bus, (f + 1) % drainEvery == 0 || f + 1 == frames);
+    }
+  }
+  double wall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+  if(writer && !writer->close()){
+    fprintf(stderr, "%s: write failed\n", writePath.c_str());
+    return 1;
+  }
+
+  // ISR benchmark: all buses' edges in time order, into fresh remotes
+  std::stable_sort(recorded.begin(), recorded.end(), [](const RecordedEdge &a, const RecordedEdge &b){ return a.time < b.time; });
+  std::vector<std::unique_ptr<SimBus>> bench;
+  void (*isrs[MAX_BUSES])();
+  for(unsigned b = 0; b<buses; b++){
+    SimBus *bus = new SimBus(timing, seed + b);
+    bus->port = &ports[b];
+    bus->remote.reset(bus->port->create(&bus->pulseTimer));
+    bus->remote->setSubscriptions(subscriptions);
+    isrs[b] = host::isrs[bus->port->pin];
+    bench.emplace_back(bus);
+  }
+  Clock::duration isrTime = Clock::duration::zero();
+  for(size_t i = 0; i<recorded.size(); i += BENCH_BATCH){
+    size_t end = std::min(recorded.size(), i + BENCH_BATCH);
+    Clock::time_point start = Clock::now();
+    for(size_t e = i; e<end; e++){
+      const RecordedEdge &edge = recorded[e];
+      host::now = edge.time;
+      *ports[edge.bus].level = edge.level;
+      isrs[edge.bus]();
+    }
+    isrTime += Clock::now() - start;
+    for(unsigned b = 0; b<buses; b++) drain(*bench[b]);
+  }
+
+  unsigned long playerMessages = 0, remoteMessages = 0, events = 0, decoded = 0, checksumErrors = 0, overflows = 0, eventOverflows = 0, suppressed = 0;
+  unsigned long capabilityAnswers = 0, remoteErrors = 0, answerFrames = 0, answerFramesMax = 0;
+  unsigned long outboundQueued = 0, outboundRejected = 0, outboundSent = 0, outboundExpired = 0;
+  unsigned long eventsByType[EVENT_TYPES] = {};
+  uint64_t busTime = 0;
+  for(unsigned b = 0; b<buses; b++){
+    SimBus &bus = *sim[b];
+    BusTelemetry telemetry;
+    bus.remote->getTelemetry(telemetry);
+    playerMessages += bus.playerMessages;
+    remoteMessages += bus.remoteMessages;
+    capabilityAnswers += bus.capabilityAnswers;
+    remoteErrors += bus.remoteErrors;
+    answerFrames += bus.answerFrames;
+    answerFramesMax = std::max(answerFramesMax, bus.answerFramesMax);
+    outboundQueued += telemetry.outboundQueued;
+    outboundRejected += telemetry.outboundRejected;
+    outboundSent += telemetry.outboundSent;
+    outboundExpired += telemetry.outboundExpired;
+    events += bus.events;
+    decoded += telemetry.messagesReceived;
+    checksumErrors += telemetry.checksumFailures;
+    overflows += telemetry.queueOverflows;
+    eventOverflows += telemetry.eventOverflows;
+    suppressed += bus.coalescer.getSuppressed();
+    for(size_t t = 0; t<sizeof(eventsByType) / sizeof(*eventsByType); t++) eventsByType[t] += bus.eventsByType[t];
+    busTime = std::max(busTime, bus.generator.now);
+    if(buses > 1){
+      printf("bus %u (pin %u)       %lu messages, %u decoded, %u checksum errors, threshold %lu us\n", b, bus.port->pin,
+        bus.playerMessages, telemetry.messagesReceived, telemetry.checksumFailures, bus.remote->getBitThreshold());
+    }
+  }
+  double bus = busTime / 1e6;
+
+  printf("frames             %lu x %u buses\n", frames, buses);
+  printf("player messages    %lu\n", playerMessages);
+  printf("decoded            %lu (lost %ld)\n", decoded, (long) playerMessages - (long) decoded);
+  printf("checksum errors    %lu\n", checksumErrors);
+  printf("queue overflows    %lu messages, %lu events\n", overflows, eventOverflows);
+  printf("events             %lu (text %lu, track %lu, volume %lu, battery %lu)\n", events,
+    eventsByType[static_cast<int>(EventType::LCD_TEXT)], eventsByType[static_cast<int>(EventType::TRACK_NUMBER)],
+    eventsByType[static_cast<int>(EventType::VOLUME_LEVEL)], eventsByType[static_cast<int>(EventType::BATTERY_LEVEL)]);
+  if(coalesce) printf("coalesced          %lu events suppressed\n", suppressed);
+  printf("remote messages    %lu (%lu capability answers, %lu bad checksums)\n", remoteMessages, capabilityAnswers, remoteErrors);
+  if(capabilityAnswers) printf("answer delay       %.1f frames, max %lu\n", (double) answerFrames / capabilityAnswers, answerFramesMax);
+  printf("outbound           %lu queued, %lu sent, %lu expired, %lu rejected\n", outboundQueued, outboundSent, outboundExpired, outboundRejected);
+  if(buses == 1) printf("bit threshold      %lu us\n", sim[0]->remote->getBitThreshold());
+  printf("bus time           %.2f s, %.1f messages/s\n", bus, decoded / bus);
+  printf("host time          %.3f s, %.0f messages/s\n", wall, decoded / wall);
+  printf("ISR cost           %.1f ns/edge over %zu edges\n",
+    std::chrono::duration<double, std::nano>(isrTime).count() / recorded.size(), recorded.size());
+  return 0;
+}
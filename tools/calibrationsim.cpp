@@ -0,0 +1,139 @@
+/*
+  Bit threshold validation - runs synthetic buses with players of different timing through
+  two AsyncSonyRemotes side by side: one with the adaptive BitClassifier, one held at the
+  static DATABIT_LOW_RANGE upper bound as before. Each scenario moves the 0 / 1 pulse widths,
+  adds jitter or lets every width drift over the run. The tool exits with 1 if, in any of
+  them, the adaptive decoder gets fewer messages through than were sent minus the frames it
+  takes to settle (STARTUP_FRAMES) - lost messages and checksum errors both count.
+
+  Only the data bit threshold adapts - presync and sync still have to fit PRESYNC_RANGE /
+  SYNC_RANGE, so jitter and drift stay inside those. Past them both decoders lose frames alike.
+
+  g++ -std=c++17 -O2 -Itools/host -Iremoteemulator tools/calibrationsim.cpp remoteemulator/sonyremote.cpp \
+      remoteemulator/asyncsonyremote.cpp remoteemulator/remotepackets.cpp remoteemulator/pulsetimer.cpp \
+      remoteemulator/timebase.cpp remoteemulator/bitclassifier.cpp remoteemulator/binlog.cpp -o calibrationsim
+
+  calibrationsim [--frames N] [--seed N]
+*/
+
+#include <string>
+#include "sonyremote.h"
+#include "busgen.h"
+
+#define ADAPTIVE_PIN 3
+#define STATIC_PIN 4
+#define STARTUP_FRAMES 50 /*Before the first few recalibrations the threshold is still the static one*/
+
+// The decoder before the histogram: the threshold can't leave the static 0-bit window
+template<class Pin>
+class StaticRemote : public AsyncSonyRemote<Pin>{
+  public:
+  StaticRemote(PulseTimer *pulseTimer) : AsyncSonyRemote<Pin>(pulseTimer){
+    this->bus.bitClassifier = BitClassifier(DATABIT_LOW_RANGE, 250, 250);
+  }
+};
+
+struct Scenario{
+  const char *name;
+  double zero, one, jitter, drift;
+};
+
+static const Scenario scenarios[] = {
+  { "nominal",         180, 400,  0,  0 },
+  { "jitter 25",       180, 400, 25,  0 },
+  { "slow player",     262, 470, 10,  0 },
+  { "fast player",     130, 320, 10,  0 },
+  { "slow, jitter 25", 262, 470, 25,  0 },
+  { "drifting slower", 180, 400,  5,  0.00003 }, // +9% over 3000 frames
+  { "drifting faster", 180, 400,  5, -0.00003 },
+};
+
+struct Result{
+  uint32_t decoded, checksumErrors;
+  ul threshold;
+};
+
+template<class Remote, class Pin>
+static Result run(const Scenario &scenario, unsigned long frames, uint32_t seed){
+  BusTiming timing;
+  timing.zero = scenario.zero;
+  timing.one = scenario.one;
+  timing.jitter = scenario.jitter;
+  timing.drift = scenario.drift;
+  BusGenerator generator(timing, seed);
+  std::mt19937 random(seed);
+
+  SimulatedPulseTimer pulseTimer;
+  Remote remote(&pulseTimer);
+  remote.begin();
+  void (*isr)() = host::isrs[Pin::pin];
+  uint32_t pulsesSeen = 0;
+
+  for(unsigned long f = 0; f<frames; f++){
+    BusFrame frame;
+    frame.hasData = true;
+    uint8_t *p = frame.payload;
+    switch(random() % 3){
+      case 0:
+        memset(p, 0xff, 10);
+        p[0] = 0xc8; p[1] = 0x01; p[2] = 0x00;
+        for(uint8_t i = 3; i<10; i++) p[i] = 0x20 + random() % 0x5f;
+        break;
+      case 1:
+        p[0] = 0xa0; p[1] = 0x01; p[4] = random() % 30 + 1;
+        break;
+      case 2:
+        p[0] = 0x40; p[1] = random() % 31;
+        break;
+    }
+    finishMessage(p);
+
+    auto edge = [&](bool level, uint64_t time){
+      host::now = time;
+      Pin::level = level;
+      isr();
+    };
+    auto remoteDrives = [&](){
+      bool driven = pulseTimer.pulses != pulsesSeen;
+      pulsesSeen = pulseTimer.pulses;
+      return driven;
+    };
+    generator.frame(frame, edge, remoteDrives);
+    while(remote.handleMessage());
+    remote.drainEvents();
+  }
+
+  BusTelemetry telemetry;
+  remote.getTelemetry(telemetry);
+  return { telemetry.messagesReceived, telemetry.checksumFailures, remote.getBitThreshold() };
+}
+
+int main(int argc, char **argv){
+  unsigned long frames = 3000;
+  uint32_t seed = 1;
+
+  for(int i = 1; i + 1 < argc; i += 2){
+    std::string opt = argv[i];
+    const char *value = argv[i + 1];
+    if(opt == "--frames") frames = strtoul(value, NULL, 10);
+    else if(opt == "--seed") seed = strtoul(value, NULL, 10);
+    else{
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  unsigned failures = 0;
+  // Messages that got through (decoded, checksum valid) out of those sent
+  printf("%-16s %7s %7s %14s %14s %10s\n", "scenario", "0 (us)", "1 (us)", "adaptive", "static", "threshold");
+  for(const Scenario &s : scenarios){
+    Result adaptive = run<AsyncSonyRemote<HostPin<ADAPTIVE_PIN>>, HostPin<ADAPTIVE_PIN>>(s, frames, seed);
+    Result fixed = run<StaticRemote<HostPin<STATIC_PIN>>, HostPin<STATIC_PIN>>(s, frames, seed);
+    bool ok = adaptive.decoded - adaptive.checksumErrors + STARTUP_FRAMES >= frames;
+    if(!ok) ++failures;
+    printf("%-16s %7.0f %7.0f %8u/%-5lu %8u/%-5lu %7lu us %s\n", s.name, s.zero, s.one,
+      adaptive.decoded - adaptive.checksumErrors, frames, fixed.decoded - fixed.checksumErrors, frames,
+      adaptive.threshold, ok ? "" : "FAILED");
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+/*
+  Capability profile check - asks SonyRemote for its capabilities once per CapabilityProfile,
+  the way a player does, and compares the bits it sends with the frames written out below.
+  Exits with 1 if any answer is off, if a checksum is wrong, or if a request for an unknown
+  block gets answered.
+
+  g++ -std=c++17 -O2 -Itools/host -Iremoteemulator tools/capcheck.cpp remoteemulator/sonyremote.cpp \
+      remoteemulator/remotepackets.cpp remoteemulator/binlog.cpp -o capcheck
+
+  capcheck
+*/
+
+#include "offlineremote.h"
+
+struct Profile{
+  CapabilityProfile profile;
+  const char *name;
+  uint8_t frame[11];
+};
+
+static const Profile profiles[CAPABILITY_PROFILES] = {
+  { CapabilityProfile::NARROW_TEXT, "NARROW_TEXT", { 0xc0, 0x01, 0x09, 0x00, 0x00, 0x10, 0x0c, 0x80, 0x00, 0x10, 0x44 } },
+  { CapabilityProfile::FULL_WIDTH,  "FULL_WIDTH",  { 0xc0, 0x01, 0xff, 0x00, 0x00, 0x20, 0x0c, 0x80, 0x00, 0x10, 0x82 } },
+  { CapabilityProfile::KANJI,       "KANJI",       { 0xc0, 0x01, 0xff, 0x00, 0x00, 0x20, 0x0c, 0x80, 0x20, 0x10, 0xa2 } },
+};
+
+static void print(const char *label, const uint8_t *frame, size_t length){
+  printf("  %-9s", label);
+  for(size_t i = 0; i<length; i++) printf(" %02x", frame[i]);
+  printf("\n");
+}
+
+int main(){
+  static const uint8_t request[11] = { 0x01, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0x00 };
+  static const uint8_t unknownBlock[11] = { 0x01, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0x03 };
+  unsigned failures = 0;
+
+  for(const Profile &p : profiles){
+    OfflineRemote remote;
+    remote.setCapabilityProfile(p.profile);
+    remote.handle(request);
+    const uint8_t *table = SonyRemote::getCapabilityFrame(p.profile);
+
+    bool ok = remote.sent.size() == 11 && !memcmp(remote.sent.data(), p.frame, 11) && !memcmp(table, p.frame, 11) &&
+      OfflineRemote::isValid(table) && remote.finalised == 1 && remote.priority == OutboundPriority::RESPONSE;
+    printf("%-12s %s\n", p.name, ok ? "ok" : "FAILED");
+    if(!ok){
+      ++failures;
+      print("expected", p.frame, 11);
+      print("table", table, 11);
+      print("sent", remote.sent.data(), remote.sent.size());
+      printf("  finalised %u times\n", remote.finalised);
+    }
+  }
+
+  // Only block 0x01 is known - anything else stays unanswered
+  OfflineRemote remote;
+  remote.handle(unknownBlock);
+  bool ok = remote.sent.empty() && remote.finalised == 0;
+  printf("%-12s %s\n", "block 0x02", ok ? "ok" : "FAILED");
+  if(!ok) ++failures;
+
+  return failures ? 1 : 0;
+}
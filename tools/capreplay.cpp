@@ -0,0 +1,155 @@
+/*
+  Capture replay - runs a logic analyzer recording of a real bus through AsyncSonyRemote.
+  The edges are streamed from the file into the decoder's ISR through HostPin and the
+  simulated micros() clock, decoded messages go through handlePlayerMessage() as on the
+  device, and every event is printed with its capture time.
+  --passive decodes like the firmware's sniffer: frames a real remote sent are printed too.
+  --write also stores the edges as a compact .edges capture, which replays can --seek into.
+
+  g++ -std=c++17 -O2 -Itools/host -Iremoteemulator tools/capreplay.cpp remoteemulator/sonyremote.cpp \
+      remoteemulator/asyncsonyremote.cpp remoteemulator/remotepackets.cpp remoteemulator/pulsetimer.cpp \
+      remoteemulator/timebase.cpp remoteemulator/bitclassifier.cpp remoteemulator/binlog.cpp \
+      remoteemulator/edgecapture.cpp -lz -o capreplay
+
+  Built with -DASYNC_DEFERRED_DECODING the ISR only queues the edges and handleMessage()
+  decodes them, as in the firmware's deferred mode - the edges/s then cover both halves,
+  and edges lost to a full EDGE_QUEUE_LENGTH ring are reported.
+
+  capreplay [--channel name|probe] [--invert] [--quiet] [--passive] [--seek s] [--write out.edges] [--tick-ns n]
+            capture.vcd|capture.sr|capture.edges|-
+*/
+
+#include <chrono>
+#include <string>
+#include "sonyremote.h"
+#include "capture.h"
+
+#define REPLAY_PIN 3
+
+typedef HostPin<REPLAY_PIN> ReplayPin;
+typedef std::chrono::steady_clock Clock;
+
+static const char *stateNames[TRANSMIT_STATES] = {
+  "awaiting", "before sync", "player header", "remote header", "player data", "remote data"
+};
+static const char *resetNames[RESET_REASONS] = { "presync", "sync", "remote sent", "message received", "timeout" };
+
+int main(int argc, char **argv){
+  std::string channel, path;
+  std::string writePath;
+  bool invert = false, quiet = false, passive = false;
+  double seek = -1;
+  uint32_t tickNs = 1000;
+
+  for(int i = 1; i<argc; i++){
+    std::string opt = argv[i];
+    if(opt == "--channel" && i + 1 < argc) channel = argv[++i];
+    else if(opt == "--invert") invert = true;
+    else if(opt == "--quiet") quiet = true;
+    else if(opt == "--passive") passive = true;
+    else if(opt == "--seek" && i + 1 < argc) seek = atof(argv[++i]);
+    else if(opt == "--write" && i + 1 < argc) writePath = argv[++i];
+    else if(opt == "--tick-ns" && i + 1 < argc) tickNs = strtoul(argv[++i], NULL, 10);
+    else if(path.empty() && (opt == "-" || opt[0] != '-')) path = opt;
+    else{
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if(path.empty()){
+    fprintf(stderr, "Usage: %s [--channel name|probe] [--invert] [--quiet] [--passive] [--seek s] [--write out.edges] [--tick-ns n]\n"
+                    "       capture.vcd|capture.sr|capture.edges|-\n", argv[0]);
+    return 1;
+  }
+
+  std::string error;
+  std::unique_ptr<EdgeSource> source = openCapture(path, channel, error);
+  if(!source){
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  if(seek >= 0 && !source->seek(seek * 1e9)){
+    fprintf(stderr, "%s: only .edges captures can seek\n", path.c_str());
+    return 1;
+  }
+  std::unique_ptr<EdgeCaptureWriter> writer;
+  if(!writePath.empty()){
+    FILE *out = fopen(writePath.c_str(), "wb");
+    if(!out){
+      fprintf(stderr, "%s: %s\n", writePath.c_str(), strerror(errno));
+      return 1;
+    }
+    writer.reset(new EdgeCaptureWriter(out, 4096, tickNs));
+  }
+
+  SimulatedPulseTimer pulseTimer;
+  AsyncSonyRemote<ReplayPin> remote(&pulseTimer);
+  ReplayPin::level = source->initialLevel != invert;
+  remote.setPassive(passive);
+  remote.begin();
+  void (*isr)() = host::isrs[REPLAY_PIN];
+
+  unsigned long edges = 0, events = 0;
+  uint64_t firstEdge = 0, lastEdge = 0, lowStart = 0;
+  char text[128];
+  auto drain = [&](){
+    while(remote.handleMessage()){
+      RemoteEvent *event;
+      while((event = remote.nextEvent())){
+        ++events;
+        if(quiet) continue;
+        repr(text, sizeof(text), event);
+        printf("%12.6f  %s\n", event->time / 1e6, text);
+      }
+    }
+  };
+
+  Clock::time_point wallStart = Clock::now();
+  bool level;
+  uint64_t time;
+  while(source->next(level, time)){
+    if(writer) writer->add(level, time);
+    level = level != invert;
+    if(!edges++) firstEdge = time;
+    lastEdge = time;
+    host::now = time / 1000;
+    ReplayPin::level = level;
+    isr();
+
+    // Drain once per frame - a long low is the next presync, so the previous message is complete
+    if(!level) lowStart = time;
+    else if(time - lowStart > 600000) drain();
+  }
+  drain();
+  double wall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+  if(!source->error.empty()) fprintf(stderr, "%s: %s\n", path.c_str(), source->error.c_str());
+  if(writer && !writer->close()){
+    fprintf(stderr, "%s: write failed\n", writePath.c_str());
+    return 1;
+  }
+
+  BusTelemetry telemetry;
+  remote.getTelemetry(telemetry);
+  double captured = (lastEdge - firstEdge) / 1e9;
+  printf("\nedges              %lu over %.3f s of capture\n", edges, captured);
+  printf("messages           %u (%.1f/s)\n", telemetry.messagesReceived, captured > 0 ? telemetry.messagesReceived / captured : 0);
+  printf("checksum errors    %u\n", telemetry.checksumFailures);
+  printf("unknown packets    %u\n", telemetry.unknownPackets);
+  printf("lcd truncations    %u\n", telemetry.lcdTruncations);
+  printf("queue overflows    %u\n", telemetry.queueOverflows);
+  printf("events             %lu\n", events);
+  printf("bit threshold      %lu us\n", remote.getBitThreshold());
+  printf("resets            ");
+  for(uint8_t i = 0; i<RESET_REASONS; i++) printf(" %s %u%s", resetNames[i], telemetry.resets[i], i + 1 < RESET_REASONS ? "," : "\n");
+  printf("low pulses (us)    state          count    min   mean    max\n");
+  for(uint8_t i = 0; i<TRANSMIT_STATES; i++){
+    PulseStatistics &p = telemetry.pulses[i];
+    if(!p.count) continue;
+    printf("                   %-13s %6u %6lu %6lu %6lu\n", stateNames[i], p.count, p.min, p.getMean(), p.max);
+  }
+  #ifdef ASYNC_DEFERRED_DECODING
+  printf("deferred decoding  %u edges dropped\n", remote.getDroppedEdges());
+  #endif
+  printf("host time          %.3f s, %.1fM edges/s, %.0fx real time\n", wall, edges / wall / 1e6, wall > 0 ? captured / wall : 0);
+  return source->error.empty() ? 0 : 1;
+}
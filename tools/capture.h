@@ -0,0 +1,480 @@
+#pragma once
+
+/*
+  Streaming readers for logic analyzer captures of the bus line.
+  Every reader yields the edges of one channel as (level, time in ns) and never holds
+  more than its read buffer in memory, so captures of any length can be replayed.
+
+  - VCD (PulseView / sigrok-cli export, '-' reads stdin)
+  - sigrok session files (.sr): zip of 'metadata' + 'logic-1-N' sample chunks, needs -lz
+  - edge captures (.edges, remoteemulator/edgecapture.h): memory mapped, can seek
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "edgecapture.h"
+
+class EdgeSource{
+  public:
+  virtual ~EdgeSource(){}
+  // false at the end of the capture
+  virtual bool next(bool &level, uint64_t &time) = 0;
+  // Continues from the first edge at or after 'time' (ns). false if the format can't seek.
+  virtual bool seek(uint64_t){ return false; }
+  // Line level before the first edge
+  bool initialLevel = true;
+  std::string error;
+};
+
+class BufferedFile{
+  public:
+  BufferedFile(FILE *file) : file(file), buffer(1 << 20){}
+  ~BufferedFile(){ if(file && file != stdin) fclose(file); }
+
+  // Makes at least 'n' bytes available unless the file ends first
+  size_t fill(size_t n){
+    if(length - position >= n) return length - position;
+    memmove(buffer.data(), buffer.data() + position, length - position);
+    length -= position;
+    position = 0;
+    if(n > buffer.size()) buffer.resize(n);
+    while(length < n){
+      size_t got = fread(buffer.data() + length, 1, buffer.size() - length, file);
+      if(!got) break;
+      length += got;
+    }
+    return length;
+  }
+
+  uint8_t *data(){ return buffer.data() + position; }
+  size_t available(){ return length - position; }
+  void consume(size_t n){ position += n; }
+
+  FILE *file;
+
+  private:
+  std::vector<uint8_t> buffer;
+  size_t position = 0, length = 0;
+};
+
+/*********************************VCD*********************************/
+
+class VCDEdgeSource : public EdgeSource{
+  public:
+  VCDEdgeSource(FILE *file, const std::string &channel) : in(file), channel(channel){
+    readHeader();
+  }
+
+  bool next(bool &level, uint64_t &time) override{
+    std::string token;
+    while(readToken(token)){
+      if(token[0] == '#'){
+        now = strtoull(token.c_str() + 1, NULL, 10) * timescale;
+      }else if((token[0] == '0' || token[0] == '1') && token.compare(1, std::string::npos, id) == 0){
+        bool l = token[0] == '1';
+        if(l == current) continue;
+        current = l;
+        level = l;
+        time = now;
+        return true;
+      }else if(token[0] == 'b' || token[0] == 'r'){
+        readToken(token); // Vector value - skip its identifier
+      }
+    }
+    return false;
+  }
+
+  private:
+  void readHeader(){
+    std::string token, name;
+    while(readToken(token)){
+      if(token == "$timescale"){
+        std::string value;
+        while(readToken(token) && token != "$end") value += token;
+        double number = atof(value.c_str());
+        if(number == 0) number = 1;
+        if(value.find("fs") != std::string::npos) timescale = number / 1e6;
+        else if(value.find("ps") != std::string::npos) timescale = number / 1e3;
+        else if(value.find("ns") != std::string::npos) timescale = number;
+        else if(value.find("us") != std::string::npos) timescale = number * 1e3;
+        else if(value.find("ms") != std::string::npos) timescale = number * 1e6;
+        else timescale = number * 1e9;
+      }else if(token == "$var"){
+        std::vector<std::string> fields;
+        while(readToken(token) && token != "$end") fields.push_back(token);
+        // type width id name
+        if(fields.size() >= 4 && fields[1] == "1" && id.empty() && (channel.empty() || fields[3] == channel)) id = fields[2];
+      }else if(token == "$enddefinitions"){
+        while(readToken(token) && token != "$end");
+        break;
+      }else if(token[0] == '$' && token != "$end" && token != "$scope" && token != "$upscope"){
+        while(readToken(token) && token != "$end"); // $date, $version, $comment
+      }
+    }
+    if(id.empty()) error = "channel '" + channel + "' not found in the VCD header";
+
+    // The first value of our signal is the initial level, not an edge
+    std::string t;
+    while(readToken(t)){
+      if(t[0] == '#'){
+        now = strtoull(t.c_str() + 1, NULL, 10) * timescale;
+      }else if((t[0] == '0' || t[0] == '1') && t.compare(1, std::string::npos, id) == 0){
+        current = initialLevel = t[0] == '1';
+        break;
+      }
+    }
+  }
+
+  bool readToken(std::string &token){
+    token.clear();
+    while(true){
+      if(!in.available() && !in.fill(1)) return !token.empty();
+      uint8_t *p = in.data();
+      size_t n = in.available(), i = 0;
+      if(token.empty()){
+        while(i < n && (p[i] == ' ' || p[i] == '\n' || p[i] == '\r' || p[i] == '\t')) i++;
+        in.consume(i);
+        if(i == n) continue;
+        p = in.data();
+        n = in.available();
+        i = 0;
+      }
+      while(i < n && p[i] != ' ' && p[i] != '\n' && p[i] != '\r' && p[i] != '\t') i++;
+      token.append((const char *) p, i);
+      in.consume(i);
+      if(i < n) return true;
+    }
+  }
+
+  BufferedFile in;
+  std::string channel, id;
+  double timescale = 1; // ns per VCD tick
+  uint64_t now = 0;
+  bool current = true;
+};
+
+/******************************sigrok .sr******************************/
+
+class SigrokEdgeSource : public EdgeSource{
+  public:
+  SigrokEdgeSource(FILE *file, const std::string &channel) : in(file), channel(channel){
+    memset(&stream, 0, sizeof(stream));
+    if(inflateInit2(&stream, -MAX_WBITS) != Z_OK) error = "zlib init failed";
+  }
+  ~SigrokEdgeSource(){ inflateEnd(&stream); }
+
+  bool next(bool &level, uint64_t &time) override{
+    while(true){
+      while(sampleOffset + unitSize <= samples.size()){
+        uint8_t byte = samples[sampleOffset + (bit >> 3)];
+        sampleOffset += unitSize;
+        bool l = byte & (1 << (bit & 0b111));
+        uint64_t index = sampleIndex++;
+        if(index == 0){
+          current = initialLevel = l;
+          continue;
+        }
+        if(l == current) continue;
+        current = l;
+        level = l;
+        time = index * 1e9 / sampleRate;
+        return true;
+      }
+      samples.erase(samples.begin(), samples.begin() + sampleOffset);
+      sampleOffset = 0;
+      if(!readChunk()) return false;
+    }
+  }
+
+  private:
+  // Reads zip entries until the next chunk of samples. false at the central directory.
+  bool readChunk(){
+    while(error.empty()){
+      if(in.fill(30) < 30) return false;
+      uint8_t *h = in.data();
+      if(read32(h) != 0x04034b50) return false; // Central directory - no more entries
+      uint16_t flags = read16(h + 6), method = read16(h + 8);
+      uint32_t compressed = read32(h + 18);
+      uint16_t nameLength = read16(h + 26), extraLength = read16(h + 28);
+      in.consume(30);
+      in.fill(nameLength + extraLength);
+      std::string name((const char *) in.data(), nameLength);
+      in.consume(nameLength + extraLength);
+
+      std::vector<uint8_t> content;
+      bool isSamples = !prefix.empty() && name.compare(0, prefix.size(), prefix) == 0;
+      if(method == 0){
+        if(flags & 0x08){
+          error = "stored zip entries with data descriptors are not supported";
+          return false;
+        }
+        in.fill(compressed);
+        content.assign(in.data(), in.data() + compressed);
+        in.consume(compressed);
+      }else if(method == 8){
+        inflateEntry(content);
+      }else{
+        error = "unsupported zip compression in " + name;
+        return false;
+      }
+      if(flags & 0x08){ // Data descriptor after the data, signature optional
+        in.fill(16);
+        in.consume(read32(in.data()) == 0x08074b50 ? 16 : 12);
+      }
+
+      if(name == "metadata") parseMetadata(std::string(content.begin(), content.end()));
+      else if(isSamples){
+        samples.insert(samples.end(), content.begin(), content.end());
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void inflateEntry(std::vector<uint8_t> &out){
+    inflateReset(&stream);
+    uint8_t chunk[1 << 16];
+    int result = Z_OK;
+    while(result != Z_STREAM_END){
+      if(!in.available() && !in.fill(1)){
+        error = "truncated capture";
+        return;
+      }
+      stream.next_in = in.data();
+      stream.avail_in = in.available();
+      stream.next_out = chunk;
+      stream.avail_out = sizeof(chunk);
+      result = inflate(&stream, Z_NO_FLUSH);
+      if(result != Z_OK && result != Z_STREAM_END){
+        error = "corrupt deflate stream";
+        return;
+      }
+      in.consume(in.available() - stream.avail_in);
+      out.insert(out.end(), chunk, chunk + (sizeof(chunk) - stream.avail_out));
+    }
+  }
+
+  void parseMetadata(const std::string &metadata){
+    size_t start = 0;
+    int probeIndex = -1;
+    while(start < metadata.size()){
+      size_t end = metadata.find('\n', start);
+      if(end == std::string::npos) end = metadata.size();
+      std::string line = metadata.substr(start, end - start);
+      start = end + 1;
+      size_t eq = line.find('=');
+      if(eq == std::string::npos) continue;
+      std::string key = line.substr(0, eq), value = line.substr(eq + 1);
+      if(key == "capturefile") prefix = value;
+      else if(key == "unitsize") unitSize = atoi(value.c_str());
+      else if(key == "samplerate"){
+        sampleRate = atof(value.c_str());
+        if(value.find("GHz") != std::string::npos) sampleRate *= 1e9;
+        else if(value.find("MHz") != std::string::npos) sampleRate *= 1e6;
+        else if(value.find("kHz") != std::string::npos) sampleRate *= 1e3;
+      }else if(key.compare(0, 5, "probe") == 0 && probeIndex < 0){
+        int index = atoi(key.c_str() + 5) - 1;
+        if(value == channel || (channel.empty() && index == 0) || channel == std::to_string(index + 1)) probeIndex = index; // Probe numbers count from 1, like the probeN keys
+      }
+    }
+    if(probeIndex < 0) error = "channel '" + channel + "' not found in the session metadata";
+    else bit = probeIndex;
+    if(sampleRate <= 0) error = "no samplerate in the session metadata";
+  }
+
+  static uint16_t read16(const uint8_t *p){ return p[0] | (p[1] << 8); }
+  static uint32_t read32(const uint8_t *p){ return read16(p) | ((uint32_t) read16(p + 2) << 16); }
+
+  BufferedFile in;
+  z_stream stream;
+  std::string channel, prefix;
+  double sampleRate = 0;
+  unsigned unitSize = 1, bit = 0;
+  std::vector<uint8_t> samples;
+  size_t sampleOffset = 0;
+  uint64_t sampleIndex = 0;
+  bool current = true;
+};
+
+/*****************************edge capture*****************************/
+
+class MappedEdgeCapture : public EdgeSource{
+  public:
+  MappedEdgeCapture(const std::string &path){
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0){
+      error = path + ": " + strerror(errno);
+      if(fd >= 0) close(fd);
+      return;
+    }
+    length = st.st_size;
+    if(length) map = (const uint8_t *) mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED || length < sizeof(EdgeCaptureHeader)){
+      map = NULL;
+      error = path + ": not an edge capture";
+      return;
+    }
+    const EdgeCaptureHeader *header = (const EdgeCaptureHeader *) map;
+    if(header->magic != EDGE_CAPTURE_MAGIC || header->version != EDGE_CAPTURE_VERSION || header->blockSize <= sizeof(EdgeBlockHeader)){
+      error = path + ": not an edge capture";
+      return;
+    }
+    blockSize = header->blockSize;
+    tickNs = header->tickNs;
+    blocks = (length - sizeof(EdgeCaptureHeader)) / blockSize;
+
+    // The trailer is optional - a capture cut short (or streamed from the device) has none
+    const EdgeIndexFooter *footer = (const EdgeIndexFooter *) (map + length - sizeof(EdgeIndexFooter));
+    if(length >= sizeof(EdgeCaptureHeader) + sizeof(EdgeIndexFooter) && footer->magic == EDGE_INDEX_MAGIC){
+      size_t indexed = sizeof(EdgeCaptureHeader) + (size_t) footer->blocks * blockSize + footer->blocks * sizeof(uint64_t) + sizeof(EdgeIndexFooter);
+      if(indexed == length){
+        blocks = footer->blocks;
+        index = (const uint64_t *) (map + sizeof(EdgeCaptureHeader) + blocks * blockSize);
+      }
+    }
+    while(blocks && !block(blocks - 1)->edges) blocks--;
+    startBlock(0);
+    bool level;
+    uint64_t time;
+    if(blocks && decoder.next(level, time)){
+      initialLevel = !level;
+      startBlock(0); // Rewind
+    }
+  }
+  ~MappedEdgeCapture(){ if(map) munmap((void *) map, length); }
+
+  bool next(bool &level, uint64_t &time) override{
+    uint64_t ticks;
+    while(!decoder.next(level, ticks)){
+      if(current + 1 >= blocks) return false;
+      startBlock(current + 1);
+    }
+    time = ticks * tickNs;
+    return true;
+  }
+
+  bool seek(uint64_t time) override{
+    uint64_t ticks = time / tickNs;
+    // Last block starting at or before 'ticks'
+    size_t lo = 0, hi = blocks;
+    while(hi - lo > 1){
+      size_t mid = (lo + hi) / 2;
+      if(startTime(mid) <= ticks) lo = mid;
+      else hi = mid;
+    }
+    startBlock(lo);
+    bool level;
+    uint64_t t;
+    while(true){
+      size_t before = current;
+      EdgeBlockDecoder peek = decoder;
+      if(!next(level, t)) return true;
+      if(t >= time){
+        initialLevel = !level;
+        if(current == before) decoder = peek;
+        else startBlock(current); // The edge was the first of the next block
+        return true;
+      }
+    }
+  }
+
+  // Block level access for tools that split the capture
+  size_t getBlocks(){ return blocks; }
+  uint64_t getBlockTime(size_t i){ return startTime(i) * tickNs; }
+  void seekBlock(size_t i){ startBlock(i); }
+  bool isIndexed(){ return index != NULL; }
+
+  private:
+  const EdgeBlockHeader *block(size_t i){ return (const EdgeBlockHeader *) (map + sizeof(EdgeCaptureHeader) + i * blockSize); }
+  uint64_t startTime(size_t i){ return index ? index[i] : block(i)->startTime; }
+  void startBlock(size_t i){
+    current = i;
+    decoder = i < blocks ? EdgeBlockDecoder((const uint8_t *) block(i), blockSize) : EdgeBlockDecoder(NULL, 0);
+  }
+
+  const uint8_t *map = NULL;
+  size_t length = 0, blocks = 0, current = 0;
+  uint16_t blockSize = 0;
+  uint32_t tickNs = 1;
+  const uint64_t *index = NULL;
+  EdgeBlockDecoder decoder = EdgeBlockDecoder(NULL, 0);
+};
+
+// Writes an edge capture with its index trailer. Times are ns, stored as 'tickNs' ticks.
+class EdgeCaptureWriter{
+  public:
+  EdgeCaptureWriter(FILE *file, uint16_t blockSize = 4096, uint32_t tickNs = 1000)
+    : file(file), tickNs(tickNs), buffer(blockSize), encoder(buffer.data(), blockSize){
+    EdgeCaptureHeader header;
+    initEdgeCaptureHeader(header, blockSize, tickNs);
+    fwrite(&header, sizeof(header), 1, file);
+    encoder.reset(0);
+  }
+
+  void add(bool level, uint64_t time){
+    uint64_t ticks = time / tickNs;
+    if(encoder.isEmpty()) index.push_back(ticks);
+    if(!encoder.add(level, ticks)){
+      flushBlock();
+      index.push_back(ticks);
+      encoder.add(level, ticks);
+    }
+  }
+
+  // Writes the last block and the index. Returns false on a write error.
+  bool close(){
+    if(!encoder.isEmpty()) flushBlock();
+    fwrite(index.data(), sizeof(uint64_t), index.size(), file);
+    EdgeIndexFooter footer = { (uint32_t) index.size(), EDGE_INDEX_MAGIC };
+    fwrite(&footer, sizeof(footer), 1, file);
+    bool ok = !ferror(file);
+    if(file != stdout) ok = fclose(file) == 0 && ok;
+    file = NULL;
+    return ok;
+  }
+
+  private:
+  void flushBlock(){
+    encoder.finish();
+    fwrite(buffer.data(), buffer.size(), 1, file);
+    encoder.reset(index.size());
+  }
+
+  FILE *file;
+  uint32_t tickNs;
+  std::vector<uint8_t> buffer;
+  EdgeBlockEncoder encoder;
+  std::vector<uint64_t> index;
+};
+
+// Picks the reader from the file name. 'channel' is a signal name or probe number, empty for the first one.
+inline std::unique_ptr<EdgeSource> openCapture(const std::string &path, const std::string &channel, std::string &error){
+  if(path.size() > 6 && path.compare(path.size() - 6, 6, ".edges") == 0){
+    std::unique_ptr<EdgeSource> source(new MappedEdgeCapture(path));
+    error = source->error;
+    return error.empty() ? std::move(source) : NULL;
+  }
+  FILE *file = path == "-" ? stdin : fopen(path.c_str(), "rb");
+  if(!file){
+    error = path + ": " + strerror(errno);
+    return NULL;
+  }
+  std::unique_ptr<EdgeSource> source;
+  if(path.size() > 3 && path.compare(path.size() - 3, 3, ".sr") == 0) source.reset(new SigrokEdgeSource(file, channel));
+  else source.reset(new VCDEdgeSource(file, channel));
+  error = source->error;
+  return error.empty() ? std::move(source) : NULL;
+}
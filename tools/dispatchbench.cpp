@@ -0,0 +1,148 @@
+/*
+  Packet dispatch benchmark - runs SonyRemote's packet handlers over pre-built player
+  messages, no bus involved, and reports the cost per message and per packet.
+  The default mix follows what a player sends while playing: LCD text segments, track
+  numbers, volume and battery, and every so often a bundle of indicators in one message.
+
+  g++ -std=c++17 -O2 -Itools/host -Iremoteemulator tools/dispatchbench.cpp remoteemulator/sonyremote.cpp \
+      remoteemulator/remotepackets.cpp remoteemulator/binlog.cpp -o dispatchbench
+
+  --bitwise 1 reads every frame the way the parser did before FrameReader: eight virtual
+  readDataBit() calls per byte with a running checksum, then the same handlers. Comparing it
+  with the default shows what byte-level parsing saves per message.
+
+  dispatchbench [--messages N] [--rounds N] [--seed N] [--subscribe mask] [--bitwise 0|1]
+                [--mix text,track,volume,battery,indicators,unknown]
+*/
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "offlineremote.h"
+#include "busgen.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// The old per-bit access: the frame was pulled through readDataBit() one bit at a time
+class BitReader{
+  public:
+  virtual ~BitReader(){}
+  virtual bool readDataBit() = 0;
+
+  uint8_t readDataByte(uint8_t &checksum){
+    uint8_t b = 0;
+    for(uint8_t i = 0; i<8; i++) b |= readDataBit() << i;
+    checksum ^= b;
+    return b;
+  }
+};
+
+class FrameBitReader : public BitReader{
+  public:
+  const uint8_t *frame;
+  uint8_t cursor;
+
+  virtual bool readDataBit(){
+    bool b = frame[cursor >> 3] & (1 << (cursor & 0b111));
+    ++cursor;
+    return b;
+  }
+};
+
+int main(int argc, char **argv){
+  unsigned long messages = 4096, rounds = 200;
+  uint32_t seed = 1;
+  uint16_t subscriptions = 0xffff;
+  bool bitwise = false;
+  double mix[6] = { 6, 1, 2, 1, 1, 0 }; // text, track, volume, battery, indicators, unknown
+
+  for(int i = 1; i + 1 < argc; i += 2){
+    std::string opt = argv[i];
+    const char *value = argv[i + 1];
+    if(opt == "--messages") messages = strtoul(value, NULL, 10);
+    else if(opt == "--rounds") rounds = strtoul(value, NULL, 10);
+    else if(opt == "--seed") seed = strtoul(value, NULL, 10);
+    else if(opt == "--subscribe") subscriptions = strtoul(value, NULL, 16);
+    else if(opt == "--bitwise") bitwise = atoi(value);
+    else if(opt == "--mix") sscanf(value, "%lf,%lf,%lf,%lf,%lf,%lf", &mix[0], &mix[1], &mix[2], &mix[3], &mix[4], &mix[5]);
+    else{
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::mt19937 random(seed);
+  std::discrete_distribution<int> pick(mix, mix + 6);
+  std::vector<Payload> input;
+  unsigned long packets = 0;
+  for(unsigned long m = 0; m<messages; m++){
+    uint8_t r = random();
+    switch(pick(random)){
+      case 0: // Two segments of the time / a title
+        input.push_back(framePayload({ 0xc8, 0x02, 0x00, ' ', '1', ':', '2', '3', 0xff, 0xff }));
+        input.push_back(framePayload({ 0xc8, 0x01, 0x00, (uint8_t) ('0' + r % 10), 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }));
+        packets += 2;
+        break;
+      case 1:
+        input.push_back(framePayload({ 0xa0, 0x01, 0x00, 0x00, (uint8_t) (r % 30 + 1) }));
+        ++packets;
+        break;
+      case 2:
+        input.push_back(framePayload({ 0x40, (uint8_t) (r % 31) }));
+        ++packets;
+        break;
+      case 3:
+        input.push_back(framePayload({ 0x43, 0xbf }));
+        ++packets;
+        break;
+      case 4: // Volume, playback mode, EQ, battery, record and alarm in one go
+        input.push_back(framePayload({ 0x40, (uint8_t) (r % 31), 0x41, 0x00, 0x46, 0x01, 0x43, 0xbf, 0x42, 0x00 }));
+        input.push_back(framePayload({ 0x47, 0x00 }));
+        packets += 6;
+        break;
+      case 5: // A type nothing knows - the rest of the message is lost
+        input.push_back(framePayload({ 0x40, (uint8_t) (r % 31), 0x6e, 0x01, 0x43, 0xbf }));
+        packets += 3;
+        break;
+    }
+  }
+
+  OfflineRemote remote;
+  remote.setSubscriptions(subscriptions);
+  BitReader *bits = new FrameBitReader(); // Through a pointer, so the calls stay virtual
+  uint8_t frame[11];
+  unsigned long events = 0, bitwiseErrors = 0;
+  Clock::duration best = Clock::duration::max();
+  for(unsigned long round = 0; round<rounds; round++){
+    Clock::time_point start = Clock::now();
+    for(const Payload &m : input){
+      if(bitwise){
+        FrameBitReader *reader = static_cast<FrameBitReader *>(bits);
+        reader->frame = m.bytes;
+        reader->cursor = 0;
+        uint8_t sum = 0;
+        for(uint8_t i = 0; i<11; i++) frame[i] = bits->readDataByte(sum);
+        if(sum) ++bitwiseErrors;
+        remote.handle(frame);
+      }else{
+        remote.handle(m.bytes);
+      }
+      events += remote.drainEvents().count;
+    }
+    best = std::min(best, Clock::now() - start);
+  }
+
+  BusTelemetry telemetry;
+  remote.getTelemetry(telemetry);
+  double ns = std::chrono::duration<double, std::nano>(best).count();
+  printf("messages           %zu (%lu packets) x %lu rounds\n", input.size(), packets, rounds);
+  printf("events             %lu per round\n", events / rounds);
+  printf("unknown packets    %u\n", telemetry.unknownPackets);
+  printf("dispatch           %.1f ns/message, %.1f ns/packet (best round)%s\n", ns / input.size(), ns / packets,
+    bitwise ? ", frames read bit by bit" : "");
+  printf("throughput         %.2fM messages/s\n", input.size() / ns * 1e3);
+  if(bitwiseErrors) printf("bitwise checksums  %lu bad\n", bitwiseErrors);
+  delete bits;
+  return 0;
+}
@@ -0,0 +1,160 @@
+/*
+  Receives the firmware's logic analyzer stream (remoteemulator/edgestream.h) and writes
+  it to a .edges capture that capreplay / pardecode read.
+  On a serial port it switches the device into streaming mode and back to remote emulation
+  on exit (Ctrl-C or --seconds). A file or '-' is read as a raw dump of the stream.
+
+  g++ -std=c++17 -O2 -Itools/host -Iremoteemulator tools/edgerecv.cpp remoteemulator/edgecapture.cpp -lz -o edgerecv
+
+  edgerecv [--seconds N] /dev/ttyACM0|dump.bin|- out.edges
+*/
+
+#include <signal.h>
+#include <termios.h>
+#include <chrono>
+#include <string>
+#include "capture.h"
+#include "edgestream.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static volatile sig_atomic_t stopRequested = 0;
+static void onSignal(int){ stopRequested = 1; }
+
+int main(int argc, char **argv){
+  double seconds = 0;
+  std::string inPath, outPath;
+  for(int i = 1; i<argc; i++){
+    std::string opt = argv[i];
+    if(opt == "--seconds" && i + 1 < argc) seconds = atof(argv[++i]);
+    else if(inPath.empty() && (opt == "-" || opt[0] != '-')) inPath = opt;
+    else if(outPath.empty() && opt[0] != '-') outPath = opt;
+    else{
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if(inPath.empty() || outPath.empty()){
+    fprintf(stderr, "Usage: %s [--seconds N] /dev/ttyACM0|dump.bin|- out.edges\n", argv[0]);
+    return 1;
+  }
+
+  int fd = inPath == "-" ? 0 : open(inPath.c_str(), O_RDWR | O_NOCTTY);
+  if(fd < 0) fd = open(inPath.c_str(), O_RDONLY);
+  if(fd < 0){
+    perror(inPath.c_str());
+    return 1;
+  }
+  bool device = isatty(fd);
+  if(device){
+    struct termios tty;
+    tcgetattr(fd, &tty);
+    cfmakeraw(&tty);
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 2; // read() returns after 200ms without data, so Ctrl-C is noticed
+    tcsetattr(fd, TCSANOW, &tty);
+    tcflush(fd, TCIFLUSH);
+    char command = EDGE_STREAM_START;
+    if(write(fd, &command, 1) != 1){
+      perror(inPath.c_str());
+      return 1;
+    }
+  }
+  signal(SIGINT, onSignal);
+
+  FILE *out = fopen(outPath.c_str(), "wb");
+  if(!out){
+    perror(outPath.c_str());
+    return 1;
+  }
+  EdgeCaptureWriter writer(out);
+
+  std::vector<uint8_t> buffer;
+  size_t position = 0;
+  uint8_t chunk[4096];
+  unsigned long blocks = 0, lost = 0, corrupt = 0, restarts = 0, edges = 0, skipped = 0;
+  uint64_t bytes = 0, offset = 0, lastTime = 0;
+  uint32_t expected = 0;
+  Clock::time_point start = Clock::now(), lastReport = start;
+
+  while(!stopRequested){
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    if(seconds > 0 && elapsed >= seconds) break;
+    ssize_t got = read(fd, chunk, sizeof(chunk));
+    if(got < 0 && errno != EINTR){
+      perror(inPath.c_str());
+      break;
+    }
+    if(got == 0 && !device) break;
+    if(got > 0){
+      buffer.insert(buffer.end(), chunk, chunk + got);
+      bytes += got;
+    }
+
+    // Find frames: magic, a sane block size and a matching checksum
+    while(buffer.size() - position >= sizeof(EdgeStreamFrameHeader)){
+      EdgeStreamFrameHeader header;
+      memcpy(&header, buffer.data() + position, sizeof(header));
+      if(header.magic != EDGE_STREAM_MAGIC || header.blockSize <= sizeof(EdgeBlockHeader) || header.blockSize > 4096){
+        ++position;
+        ++skipped;
+        continue;
+      }
+      if(buffer.size() - position < sizeof(header) + header.blockSize) break;
+      const uint8_t *block = buffer.data() + position + sizeof(header);
+      if(edgeBlockChecksum(block, header.blockSize) != header.checksum){
+        ++corrupt;
+        ++position;
+        continue;
+      }
+      position += sizeof(header) + header.blockSize;
+
+      EdgeBlockDecoder decoder(block, header.blockSize);
+      uint32_t sequence = decoder.getHeader().sequence;
+      if(blocks && sequence < expected){
+        // The device started a new stream - its clock starts over too
+        ++restarts;
+        offset = lastTime;
+      }else if(blocks){
+        lost += sequence - expected;
+      }
+      expected = sequence + 1;
+      ++blocks;
+
+      bool level;
+      uint64_t time;
+      while(decoder.next(level, time)){
+        lastTime = offset + time;
+        writer.add(level, lastTime * 1000);
+        ++edges;
+      }
+    }
+    if(position > (1 << 16)){
+      buffer.erase(buffer.begin(), buffer.begin() + position);
+      position = 0;
+    }
+
+    if(device && Clock::now() - lastReport >= std::chrono::seconds(1)){
+      lastReport = Clock::now();
+      fprintf(stderr, "\r%.0f s  %lu blocks  %lu edges  %lu lost  %.1f kB/s   ", elapsed, blocks, edges, lost, bytes / elapsed / 1e3);
+    }
+  }
+
+  if(device){
+    char command = EDGE_STREAM_STOP;
+    if(write(fd, &command, 1) != 1) perror(inPath.c_str());
+    fprintf(stderr, "\n");
+  }
+  if(!writer.close()){
+    fprintf(stderr, "%s: write failed\n", outPath.c_str());
+    return 1;
+  }
+
+  printf("blocks             %lu\n", blocks);
+  printf("edges              %lu over %.3f s of bus time\n", edges, lastTime / 1e6);
+  printf("sequence gaps      %lu\n", lost);
+  printf("corrupt frames     %lu\n", corrupt);
+  printf("stream restarts    %lu\n", restarts);
+  printf("skipped bytes      %lu\n", skipped);
+  return lost || corrupt ? 2 : 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+  Minimal Arduino API for building the protocol code on a PC.
+  Time is simulated: micros() returns host::now, which the tool advances itself.
+  Pins are plain variables and attachInterrupt() only records the handler so the
+  tool can call it when it changes a level.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define CHANGE 2
+#define FALLING 3
+#define RISING 4
+
+#define HEX 16
+#define DEC 10
+
+namespace host{
+  inline unsigned long now = 0;
+  inline FILE *serialOut = NULL; // Receives SerialUSB.write() data if set
+  inline bool pins[32];
+  inline void (*isrs[32])() = {};
+}
+
+inline unsigned long micros(){ return host::now; }
+inline unsigned long millis(){ return host::now / 1000; }
+inline void delayMicroseconds(unsigned int us){ host::now += us; }
+inline void delay(unsigned long ms){ host::now += ms * 1000; }
+
+inline void pinMode(int, int){}
+inline int digitalRead(int pin){ return host::pins[pin]; }
+inline void digitalWrite(int pin, int value){ host::pins[pin] = value; }
+
+inline int digitalPinToInterrupt(int pin){ return pin; }
+inline void attachInterrupt(int interrupt, void (*isr)(), int){ host::isrs[interrupt] = isr; }
+inline void detachInterrupt(int interrupt){ host::isrs[interrupt] = NULL; }
+inline void noInterrupts(){}
+inline void interrupts(){}
+
+// Text output is discarded - the tools print their own reports. Binary writes go to host::serialOut.
+class HostSerial{
+  public:
+  void begin(unsigned long){}
+  template<typename T> size_t print(T){ return 0; }
+  template<typename T> size_t print(T, int){ return 0; }
+  template<typename T> size_t println(T){ return 0; }
+  template<typename T> size_t println(T, int){ return 0; }
+  size_t println(){ return 0; }
+  size_t write(const uint8_t *data, size_t n){ return host::serialOut ? fwrite(data, 1, n, host::serialOut) : n; }
+  int availableForWrite(){ return 64; }
+};
+
+inline HostSerial SerialUSB;
+inline HostSerial Serial;
@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+  SonyRemote's packet handlers without a bus, for the host tools - messages come from a
+  BusDecoder, a capture or a table. Whatever the remote would answer is collected in
+  'sent' (bytes, first bit in the low bit) instead of going out.
+*/
+
+#include <vector>
+#include "sonyremote.h"
+
+class OfflineRemote : public SonyRemote{
+  public:
+  void handle(const uint8_t *message){ handlePlayerMessage(message); }
+  static bool isValid(const uint8_t *message){ return isChecksumValid(message); }
+
+  std::vector<uint8_t> sent;
+  unsigned finalised = 0; // Answers completed
+  OutboundPriority priority = OutboundPriority::NORMAL; // Of the last one
+
+  protected:
+  virtual void addBitToSend(bool b){
+    if(bits % 8 == 0) sent.push_back(0);
+    if(b) sent.back() |= 1 << (bits % 8);
+    ++bits;
+  }
+  virtual void finaliseOutboundMessage(OutboundPriority p){
+    ++finalised;
+    priority = p;
+  }
+
+  private:
+  unsigned bits = 0;
+};
@@ -0,0 +1,300 @@
+/*
+  Parallel offline decoder for long .edges captures (see capreplay --write).
+  The bus starts over at every presync, so the capture is cut into segments of whole
+  blocks and every segment is decoded on its own - a fresh BusDecoder for the framing
+  and SonyRemote's packet handlers for the messages - on a work-stealing thread pool.
+  A segment owns the messages whose presync starts inside it. It begins decoding a few
+  blocks early so the bit classifier is warmed up, and runs past its end until the next
+  owned presync. Events are merged back in capture order.
+
+  Text comes in several messages, so where the warm-up starts the LCD buffer may be missing
+  a text's beginning. Text is skipped until the warm-up has seen a final segment, and if an
+  owned text starts before that, the segment is decoded again from further back.
+
+  --check also decodes the capture in one pass the way capreplay does and exits with 1 if
+  the events differ - e.g. on a bussim --spread 30 --write capture, whose texts straddle
+  segment and warm-up starts.
+
+  g++ -std=c++17 -O2 -pthread -Itools/host -Iremoteemulator tools/pardecode.cpp remoteemulator/sonyremote.cpp \
+      remoteemulator/asyncsonyremote.cpp remoteemulator/remotepackets.cpp remoteemulator/pulsetimer.cpp \
+      remoteemulator/timebase.cpp remoteemulator/bitclassifier.cpp remoteemulator/binlog.cpp \
+      remoteemulator/edgecapture.cpp -lz -o pardecode
+
+  pardecode [--threads N] [--segment blocks] [--warmup blocks] [--quiet] [--check] capture.edges
+*/
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "offlineremote.h"
+#include "remotepackets.h"
+#include "capture.h"
+
+#define CHECK_PIN 3
+
+typedef std::chrono::steady_clock Clock;
+
+struct Segment{
+  size_t firstBlock, lastBlock; // Owned blocks, [first, last)
+  std::vector<std::string> events;
+  unsigned long edges = 0, messages = 0, checksumErrors = 0, seekBacks = 0;
+};
+
+struct Worker{
+  std::mutex lock;
+  std::deque<size_t> tasks;
+  unsigned long segments = 0, stolen = 0, edges = 0, messages = 0;
+  Clock::duration busy = Clock::duration::zero();
+};
+
+struct Job{
+  std::string path;
+  size_t warmup;
+  bool quiet;
+  std::vector<Segment> segments;
+  std::vector<uint64_t> starts; // Presync ownership boundaries (ns), one past the last segment
+};
+
+// A DisplayText segment, and whether it ends the text
+static bool isText(const uint8_t *message){ return message[0] == packets::DisplayText::type; }
+static bool isFinalText(const uint8_t *message){
+  return PacketReader<packets::DisplayText>(message + 1, 9).get<packets::SegmentType>() == 0x01;
+}
+
+// Decodes from 'startBlock' on. Returns false if an owned text began before the warm-up - the
+// segment has to start further back.
+static bool decodeFrom(Job &job, MappedEdgeCapture &capture, size_t index, size_t startBlock){
+  Segment &segment = job.segments[index];
+  uint64_t from = job.starts[index], to = job.starts[index + 1];
+  std::unique_ptr<BusDecoder> bus(new BusDecoder());
+  OfflineRemote remote;
+  segment.events.clear();
+  segment.messages = segment.checksumErrors = 0;
+
+  capture.seekBlock(startBlock);
+  bool level;
+  uint64_t time, fall = 0, presync = 0;
+  bool textSynced = startBlock == 0; // Until a final segment the LCD buffer may be missing the text's start
+  char text[128];
+  while(capture.next(level, time)){
+    ++segment.edges;
+    bus->decodeEdge(level, time / 1000);
+    if(!level){
+      fall = time;
+      continue;
+    }
+    ul low = (time - fall) / 1000;
+    if(inRange(PRESYNC_RANGE, low) || inRange(PRESYNC_RESET_RANGE, low)){
+      presync = fall;
+      if(presync >= to) break; // The next segment's first message
+    }
+
+    BusDecoder::Message *message;
+    while((message = bus->messageQueue.front())){
+      bool owned = presync >= from;
+      if(!textSynced && isText(message->data)){
+        if(owned) return false;
+        textSynced = isFinalText(message->data);
+      }else{
+        remote.handle(message->data); // Warm-up messages still build up LCD text
+      }
+      RemoteEvent *event;
+      while((event = remote.nextEvent())){
+        if(!owned || job.quiet) continue;
+        repr(text, sizeof(text), event);
+        char line[160];
+        snprintf(line, sizeof(line), "%12.6f  %s", presync / 1e9, text);
+        segment.events.push_back(line);
+      }
+      if(owned){
+        ++segment.messages;
+        if(!OfflineRemote::isValid(message->data)) ++segment.checksumErrors;
+      }
+      bus->messageQueue.drop();
+      bus->bitClassifier.recalibrate();
+    }
+  }
+  return true;
+}
+
+static void decodeSegment(Job &job, MappedEdgeCapture &capture, size_t index){
+  Segment &segment = job.segments[index];
+  size_t warmup = job.warmup;
+  while(true){
+    size_t start = segment.firstBlock > warmup ? segment.firstBlock - warmup : 0;
+    if(decodeFrom(job, capture, index, start)) return;
+    ++segment.seekBacks;
+    warmup = warmup ? warmup * 2 : 1;
+  }
+}
+
+// capreplay's decode: every edge through AsyncSonyRemote's ISR, in one pass
+static std::vector<std::string> decodeSequentially(const std::string &path){
+  typedef HostPin<CHECK_PIN> CheckPin;
+  std::vector<std::string> events;
+  MappedEdgeCapture capture(path);
+  SimulatedPulseTimer pulseTimer;
+  AsyncSonyRemote<CheckPin> remote(&pulseTimer);
+  CheckPin::level = capture.initialLevel;
+  remote.begin();
+  void (*isr)() = host::isrs[CHECK_PIN];
+
+  char text[128], line[160];
+  auto drain = [&](){
+    while(remote.handleMessage()){
+      RemoteEvent *event;
+      while((event = remote.nextEvent())){
+        repr(text, sizeof(text), event);
+        snprintf(line, sizeof(line), "%12.6f  %s", event->time / 1e6, text);
+        events.push_back(line);
+      }
+    }
+  };
+  bool level;
+  uint64_t time, lowStart = 0;
+  while(capture.next(level, time)){
+    host::now = time / 1000;
+    CheckPin::level = level;
+    isr();
+    if(!level) lowStart = time;
+    else if(time - lowStart > 600000) drain();
+  }
+  drain();
+  return events;
+}
+
+int main(int argc, char **argv){
+  unsigned threads = std::thread::hardware_concurrency();
+  size_t segmentBlocks = 16;
+  Job job;
+  job.warmup = 2;
+  job.quiet = false;
+  bool check = false;
+
+  for(int i = 1; i<argc; i++){
+    std::string opt = argv[i];
+    if(opt == "--threads" && i + 1 < argc) threads = strtoul(argv[++i], NULL, 10);
+    else if(opt == "--segment" && i + 1 < argc) segmentBlocks = strtoul(argv[++i], NULL, 10);
+    else if(opt == "--warmup" && i + 1 < argc) job.warmup = strtoul(argv[++i], NULL, 10);
+    else if(opt == "--quiet") job.quiet = true;
+    else if(opt == "--check") check = true;
+    else if(job.path.empty() && opt[0] != '-') job.path = opt;
+    else{
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if(job.path.empty()){
+    fprintf(stderr, "Usage: %s [--threads N] [--segment blocks] [--warmup blocks] [--quiet] [--check] capture.edges\n", argv[0]);
+    return 1;
+  }
+  if(!threads) threads = 1;
+  if(!segmentBlocks) segmentBlocks = 1;
+  if(check) job.quiet = false;
+
+  MappedEdgeCapture capture(job.path);
+  if(!capture.error.empty()){
+    fprintf(stderr, "%s (convert VCD / .sr captures with capreplay --write)\n", capture.error.c_str());
+    return 1;
+  }
+  size_t blocks = capture.getBlocks();
+  for(size_t b = 0; b < blocks; b += segmentBlocks){
+    Segment segment;
+    segment.firstBlock = b;
+    segment.lastBlock = std::min(b + segmentBlocks, blocks);
+    job.segments.push_back(segment);
+    job.starts.push_back(b ? capture.getBlockTime(b) : 0);
+  }
+  job.starts.push_back(UINT64_MAX);
+
+  // Contiguous runs per worker, so a thread that isn't robbed walks the file in order
+  std::vector<Worker> workers(threads);
+  for(size_t s = 0; s < job.segments.size(); s++) workers[s * threads / job.segments.size()].tasks.push_back(s);
+
+  Clock::time_point wallStart = Clock::now();
+  std::vector<std::thread> pool;
+  for(unsigned w = 0; w < threads; w++){
+    pool.emplace_back([&, w](){
+      MappedEdgeCapture reader(job.path); // Own cursor, shared page cache
+      Worker &self = workers[w];
+      while(true){
+        size_t task;
+        bool found = false, stolen = false;
+        {
+          std::lock_guard<std::mutex> guard(self.lock);
+          if(!self.tasks.empty()){
+            task = self.tasks.front();
+            self.tasks.pop_front();
+            found = true;
+          }
+        }
+        for(unsigned v = 1; !found && v < threads; v++){
+          Worker &victim = workers[(w + v) % threads];
+          std::lock_guard<std::mutex> guard(victim.lock);
+          if(!victim.tasks.empty()){
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            found = stolen = true;
+          }
+        }
+        if(!found) return;
+
+        Clock::time_point start = Clock::now();
+        decodeSegment(job, reader, task);
+        self.busy += Clock::now() - start;
+        ++self.segments;
+        self.stolen += stolen;
+        self.edges += job.segments[task].edges;
+        self.messages += job.segments[task].messages;
+      }
+    });
+  }
+  for(std::thread &t : pool) t.join();
+  double wall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+
+  unsigned long messages = 0, checksumErrors = 0, events = 0, edges = 0, seekBacks = 0;
+  std::vector<std::string> merged;
+  for(Segment &segment : job.segments){
+    for(std::string &line : segment.events) puts(line.c_str());
+    if(check) merged.insert(merged.end(), segment.events.begin(), segment.events.end());
+    messages += segment.messages;
+    checksumErrors += segment.checksumErrors;
+    events += segment.events.size();
+    seekBacks += segment.seekBacks;
+  }
+  for(Worker &worker : workers) edges += worker.edges;
+
+  double captured = blocks ? (capture.getBlockTime(blocks - 1) - capture.getBlockTime(0)) / 1e9 : 0;
+  printf("\nsegments           %zu x %zu blocks, %zu warm-up, %lu decoded again for text\n", job.segments.size(), segmentBlocks,
+    job.warmup, seekBacks);
+  printf("messages           %lu\n", messages);
+  printf("checksum errors    %lu\n", checksumErrors);
+  if(!job.quiet) printf("events             %lu\n", events);
+  printf("thread  segments  stolen      edges  messages   busy s  Medges/s\n");
+  for(unsigned w = 0; w < threads; w++){
+    Worker &worker = workers[w];
+    double busy = std::chrono::duration<double>(worker.busy).count();
+    printf("%6u  %8lu  %6lu  %9lu  %8lu  %7.3f  %8.1f\n", w, worker.segments, worker.stolen, worker.edges, worker.messages,
+      busy, busy > 0 ? worker.edges / busy / 1e6 : 0);
+  }
+  printf("host time          %.3f s, %.1fM edges/s, %.0fx real time on %u threads\n", wall, edges / wall / 1e6,
+    wall > 0 ? captured / wall : 0, threads);
+
+  if(check){
+    std::vector<std::string> sequential = decodeSequentially(job.path);
+    unsigned long differences = 0;
+    for(size_t i = 0; i < std::max(merged.size(), sequential.size()); i++){
+      const char *expected = i < sequential.size() ? sequential[i].c_str() : "-";
+      const char *got = i < merged.size() ? merged[i].c_str() : "-";
+      if(!strcmp(expected, got)) continue;
+      if(differences++ < 5) printf("event %zu\n  sequential %s\n  parallel   %s\n", i, expected, got);
+    }
+    printf("check              %zu events sequentially, %s\n", sequential.size(), differences ? "FAILED" : "ok");
+    return differences ? 1 : 0;
+  }
+  return 0;
+}
@@ -0,0 +1,200 @@
+/*
+  Polled bus simulator - drives SynchronousSonyRemote the way a main loop would: poll()
+  every --poll us, and on every IDLE the queued messages are parsed and --work us of other
+  work (a display flush, buttons) is done before the next poll. The player side comes from
+  busgen.h; the remote's pulls on the write pin are looped back as stretched pulses, so
+  capability answers and the header bits go through the poll loop too.
+
+  --stuck N holds the line low for 150ms in the middle of frame N, as a disconnected or
+  shorted bus would. The frame should be dropped with a timeout, the stuck line reported
+  once, and decoding should go on with the next frame - the tool exits with 1 if any of
+  that doesn't happen or a checksum error shows up.
+
+  --reset N starts frame N with a bus reset (PRESYNC_RESET_RANGE presync). The frame should
+  still be decoded, with the ready-for-text and initialized bits of its remote header clear
+  and those of the next frame set again.
+
+  g++ -std=c++17 -O2 -Itools/host -Iremoteemulator tools/syncsim.cpp remoteemulator/sonyremote.cpp \
+      remoteemulator/asyncsonyremote.cpp remoteemulator/remotepackets.cpp remoteemulator/pulsetimer.cpp \
+      remoteemulator/timebase.cpp remoteemulator/bitclassifier.cpp remoteemulator/binlog.cpp -o syncsim
+
+  syncsim [--frames N] [--seed N] [--jitter us] [--poll us] [--work us] [--stuck frame] [--reset frame]
+*/
+
+#include <chrono>
+#include <random>
+#include <string>
+#include "sonyremote.h"
+#include "synchronoussonyremote.h"
+#include "busgen.h"
+
+#define SIM_PIN 3
+#define STUCK_LENGTH 150000 /*us*/
+
+typedef std::chrono::steady_clock Clock;
+
+// The remote's sink pin - only counts the pulls, busgen stretches the pulse
+struct SimWritePin{
+  static const uint8_t pin = SIM_PIN + 1;
+  static uint32_t pulls;
+  static inline void begin(){}
+  static inline bool read(){ return LOW; }
+  static inline void write(bool value){ if(value) ++pulls; }
+};
+uint32_t SimWritePin::pulls = 0;
+
+typedef HostPin<SIM_PIN> SimReadPin;
+
+static const char *resetNames[RESET_REASONS] = { "presync", "sync", "remote sent", "message received", "timeout" };
+
+int main(int argc, char **argv){
+  BusTiming timing;
+  unsigned long frames = 5000, stuckFrame = ~0ul, resetFrame = ~0ul;
+  ul pollPeriod = 10, work = 0;
+  uint32_t seed = 1;
+
+  for(int i = 1; i + 1 < argc; i += 2){
+    std::string opt = argv[i];
+    const char *value = argv[i + 1];
+    if(opt == "--frames") frames = strtoul(value, NULL, 10);
+    else if(opt == "--seed") seed = strtoul(value, NULL, 10);
+    else if(opt == "--jitter") timing.jitter = atof(value);
+    else if(opt == "--poll") pollPeriod = std::max(1ul, strtoul(value, NULL, 10));
+    else if(opt == "--work") work = strtoul(value, NULL, 10);
+    else if(opt == "--stuck") stuckFrame = strtoul(value, NULL, 10);
+    else if(opt == "--reset") resetFrame = strtoul(value, NULL, 10);
+    else{
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  SynchronousSonyRemote<SimReadPin, SimWritePin> remote;
+  remote.begin();
+  BusGenerator generator(timing, seed);
+  std::mt19937 random(seed);
+
+  unsigned long polls = 0, idle = 0, timeouts = 0, stuckReports = 0, handled = 0, events = 0;
+  unsigned long playerMessages = 0, remoteMessages = 0, capabilityAnswers = 0, remoteErrors = 0;
+  ul shift = 0; // Time the line was held stuck so far
+  ul lastEdge = 0;
+  uint32_t pullsSeen = 0;
+  Clock::duration pollTime = Clock::duration::zero();
+
+  // The main loop, up to 'until'
+  auto run = [&](ul until){
+    while(host::now + pollPeriod <= until){
+      host::now += pollPeriod;
+      Clock::time_point start = Clock::now();
+      PollResult result = remote.poll();
+      pollTime += Clock::now() - start;
+      ++polls;
+      if(result == PollResult::TIMEOUT){
+        if(remote.isLineStuck()) ++stuckReports;
+        else ++timeouts;
+      }else if(result == PollResult::IDLE){
+        ++idle;
+        while(remote.handleMessage()) ++handled;
+        events += remote.drainEvents().count;
+        host::now += work;
+      }
+    }
+  };
+
+  bool remoteWantsBus = false;
+  uint8_t track = 1;
+  uint8_t resetHeaders[2] = {}; // Remote headers of the reset frame and the one after
+  long resetDropped = -1;       // Presync resets in the reset frame
+  for(unsigned long f = 0; f<frames; f++){
+    BusFrame frame;
+    frame.reset = f == resetFrame;
+    if(remoteWantsBus){
+      frame.cedeBus = true;
+    }else{
+      frame.hasData = true;
+      uint8_t *p = frame.payload;
+      if(f % 500 == 0){
+        p[0] = 0x01; p[1] = 0x01; // Capability request
+      }else switch(random() % 3){
+        case 0:
+          memset(p, 0xff, 10);
+          p[0] = 0xc8; p[1] = 0x01; p[2] = 0x00;
+          memcpy(p + 3, "Title", 5);
+          break;
+        case 1:
+          track = track % 30 + 1;
+          p[0] = 0xa0; p[1] = 0x01; p[3] = 0x00; p[4] = track;
+          break;
+        case 2:
+          p[0] = 0x40; p[1] = random() % 31;
+          break;
+      }
+      finishMessage(p);
+      ++playerMessages;
+    }
+
+    unsigned edges = 0;
+    auto edge = [&](bool level, uint64_t time){
+      ul t = time + shift;
+      run(t);
+      SimReadPin::level = level;
+      lastEdge = t;
+      if(f == stuckFrame && ++edges == 61 && level == LOW){
+        run(t + STUCK_LENGTH);
+        shift += STUCK_LENGTH;
+      }
+    };
+    auto remoteDrives = [&](){
+      // The remote answers within the player's high gap, before it pulls the line again
+      run(lastEdge + timing.high - 1);
+      bool driven = SimWritePin::pulls != pullsSeen;
+      pullsSeen = SimWritePin::pulls;
+      return driven;
+    };
+    BusTelemetry before;
+    if(frame.reset) remote.getTelemetry(before);
+    generator.frame(frame, edge, remoteDrives);
+    if(frame.reset){
+      BusTelemetry after;
+      remote.getTelemetry(after);
+      resetDropped = after.resets[static_cast<uint8_t>(ResetReason::PRESYNC)] - before.resets[static_cast<uint8_t>(ResetReason::PRESYNC)];
+    }
+    if(frame.cedeBus && (frame.remoteHeader & 0x10)){
+      ++remoteMessages;
+      uint8_t sum = 0;
+      for(uint8_t i = 0; i<11; i++) sum ^= frame.remotePayload[i];
+      if(sum) ++remoteErrors;
+      else if(frame.remotePayload[0] == 0xc0) ++capabilityAnswers;
+    }
+    remoteWantsBus = frame.remoteHeader & 0x10 && !frame.cedeBus;
+    if(resetFrame < frames && f - resetFrame < 2) resetHeaders[f - resetFrame] = frame.remoteHeader;
+  }
+  run(host::now + 2000);
+  while(remote.handleMessage()) ++handled;
+
+  BusTelemetry telemetry;
+  remote.getTelemetry(telemetry);
+  printf("frames             %lu, %lu player messages\n", frames, playerMessages);
+  printf("decoded            %u (lost %lu), %u checksum errors, %lu events\n", telemetry.messagesReceived,
+    playerMessages - telemetry.messagesReceived, telemetry.checksumFailures, events);
+  printf("remote messages    %lu (%lu capability answers, %lu bad checksums)\n", remoteMessages, capabilityAnswers, remoteErrors);
+  printf("polls              %lu every %lu us, %lu idle, %lu us work each\n", polls, pollPeriod, idle, work);
+  printf("timeouts           %lu, stuck line reported %lu times\n", timeouts, stuckReports);
+  printf("resets            ");
+  for(uint8_t i = 0; i<RESET_REASONS; i++) printf(" %s %u%s", resetNames[i], telemetry.resets[i], i + 1 < RESET_REASONS ? "," : "\n");
+  printf("poll() cost        %.1f ns\n", std::chrono::duration<double, std::nano>(pollTime).count() / polls);
+  printf("bus time           %.2f s\n", host::now / 1e6);
+  int rc = 0;
+  if(resetFrame < frames - 1){
+    // Bit 1 - ready for text, bit 7 - initialized
+    bool ok = !(resetHeaders[0] & 0x82) && (resetHeaders[1] & 0x82) == 0x82 && resetDropped == 0;
+    printf("bus reset          headers 0x%02x, 0x%02x %s\n", resetHeaders[0], resetHeaders[1], ok ? "ok" : "FAILED");
+    if(!ok) rc = 1;
+  }
+  if(stuckFrame < frames){
+    bool ok = telemetry.checksumFailures == 0 && timeouts == 1 && stuckReports == 1 && playerMessages - telemetry.messagesReceived <= 1;
+    printf("stuck line         %s\n", ok ? "ok" : "FAILED");
+    if(!ok) rc = 1;
+  }
+  return rc;
+}